@@ -0,0 +1,88 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonArena.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+
+#include "BsonArena.h"
+
+#include <stdint.h>
+
+namespace JsBsonRPC {
+
+	BsonArena::BsonArena(size_t blockSize)
+	{
+		m_blockSize = blockSize;
+		m_currentBlock = 0;
+		m_cur = NULL;
+		m_end = NULL;
+		m_generation = 0;
+	}
+
+	BsonArena::~BsonArena()
+	{
+		reset();
+		for (std::vector<unsigned char*>::iterator iter = m_blocks.begin(); iter != m_blocks.end(); iter++)
+			delete[] (*iter);
+	}
+
+	void *BsonArena::allocate(size_t size, size_t alignment)
+	{
+		uintptr_t aligned = ((uintptr_t)m_cur + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		if (m_cur && ((aligned + size) <= (uintptr_t)m_end))
+		{
+			m_cur = (unsigned char*)(aligned + size);
+			return (void*)aligned;
+		}
+
+		// Requests that would waste most of a block get their own
+		if ((size + alignment) > (m_blockSize / 4))
+		{
+			unsigned char *block = new unsigned char[size + alignment];
+			m_largeBlocks.push_back(block);
+			aligned = ((uintptr_t)block + alignment - 1) & ~(uintptr_t)(alignment - 1);
+			return (void*)aligned;
+		}
+
+		if (m_cur)
+			m_currentBlock++;
+		if (m_currentBlock >= m_blocks.size())
+			m_blocks.push_back(new unsigned char[m_blockSize]);
+		m_cur = m_blocks[m_currentBlock];
+		m_end = m_cur + m_blockSize;
+		aligned = ((uintptr_t)m_cur + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		m_cur = (unsigned char*)(aligned + size);
+		return (void*)aligned;
+	}
+
+	void BsonArena::reset()
+	{
+		for (std::vector<unsigned char*>::iterator iter = m_largeBlocks.begin(); iter != m_largeBlocks.end(); iter++)
+			delete[] (*iter);
+		m_largeBlocks.clear();
+		m_currentBlock = 0;
+		m_cur = NULL;
+		m_end = NULL;
+		m_generation++;
+	}
+
+}
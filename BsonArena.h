@@ -0,0 +1,146 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonArena.h
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <map>
+#include <vector>
+#include <deque>
+#include <new>
+#include <type_traits>
+
+namespace JsBsonRPC {
+
+	/**
+	 * Monotonic arena for decoded object graphs.
+	 * Memory is carved out of large blocks and only given back all at once by reset(), which keeps the blocks for reuse.
+	 * Every object allocated from the arena must be destroyed, or cleared with Serializable::serializableClearObjects(),
+	 * before reset(). Storage a cleared container still holds is not reused after the reset.
+	 * Pass it to Serializable::deserialize() to decode arena member types into it.
+	 */
+	class BsonArena
+	{
+	private:
+		size_t m_blockSize;
+		std::vector<unsigned char*> m_blocks;
+		std::vector<unsigned char*> m_largeBlocks;
+		size_t m_currentBlock;
+		unsigned char *m_cur;
+		unsigned char *m_end;
+		uint32_t m_generation;
+
+	public:
+		BsonArena(size_t blockSize = 65536);
+		~BsonArena();
+
+		void *allocate(size_t size, size_t alignment = alignof(max_align_t));
+
+		/**
+		 * Releases everything allocated since the last reset at once
+		 */
+		void reset();
+
+		/**
+		 * Incremented by every reset(), so allocators bound before it compare unequal to ones bound after
+		 */
+		uint32_t generation() const {
+			return m_generation;
+		}
+
+	private:
+		BsonArena(const BsonArena &obj);
+		BsonArena &operator=(const BsonArena &obj);
+	};
+
+	/**
+	 * Allocator that takes memory from the BsonArena it was constructed with, or from the heap when it has none.
+	 * A default constructed allocator uses the heap. Deserializing with an arena rebinds every container and string
+	 * it decodes into to that arena, and deserializing without one rebinds them to the heap,
+	 * so one decoded graph never mixes the two. The allocator follows move assignment and swap.
+	 */
+	template<typename T>
+	class ArenaAllocator
+	{
+	private:
+		BsonArena *m_arena;
+		uint32_t m_generation;
+
+		template<typename U> friend class ArenaAllocator;
+
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		ArenaAllocator() : m_arena(NULL), m_generation(0) {}
+		explicit ArenaAllocator(BsonArena *arena) : m_arena(arena), m_generation(arena ? arena->generation() : 0) {}
+		template<typename U>
+		ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.m_arena), m_generation(other.m_generation) {}
+
+		T *allocate(size_t n) {
+			if (m_arena)
+				return (T*)m_arena->allocate(n * sizeof(T), alignof(T));
+			return (T*)::operator new(n * sizeof(T));
+		}
+		void deallocate(T *p, size_t n) {
+			if (!m_arena)
+				::operator delete(p);
+		}
+
+		BsonArena *arena() const {
+			return m_arena;
+		}
+
+		template<typename U>
+		bool operator==(const ArenaAllocator<U> &other) const {
+			return (m_arena == other.m_arena) && (m_generation == other.m_generation);
+		}
+		template<typename U>
+		bool operator!=(const ArenaAllocator<U> &other) const {
+			return !(*this == other);
+		}
+	};
+
+	/**
+	 * Arena allocated member types, usable as SType<arena::list<int32_t> > and so on.
+	 * The keys of arena::map are arena strings as well.
+	 */
+	namespace arena {
+		typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > string;
+
+		template<typename T>
+		using vector = std::vector<T, ArenaAllocator<T> >;
+		template<typename T>
+		using list = std::list<T, ArenaAllocator<T> >;
+		template<typename T>
+		using deque = std::deque<T, ArenaAllocator<T> >;
+		template<typename T>
+		using map = std::map<string, T, std::less<string>, ArenaAllocator<std::pair<const string, T> > >;
+	}
+
+}
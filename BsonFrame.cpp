@@ -0,0 +1,161 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonFrame.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+
+#include "BsonFrame.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace JsBsonRPC {
+
+	BsonFrameReader::BsonFrameReader(const FrameHandler &handler, uint32_t maxFrameSize)
+		: m_handler(handler)
+	{
+		m_maxFrameSize = maxFrameSize;
+		m_frameSize = 0;
+	}
+
+	uint32_t BsonFrameReader::peekFrameSize(const unsigned char *data) const throw(FrameSizeException)
+	{
+		uint32_t frameSize;
+		memcpy(&frameSize, data, sizeof(frameSize));
+		if ((frameSize < 5) || (frameSize > m_maxFrameSize))
+			throw FrameSizeException();
+		return frameSize;
+	}
+
+	size_t BsonFrameReader::feed(const void *data, size_t len) throw(FrameSizeException)
+	{
+		const unsigned char *input = (const unsigned char*)data;
+		size_t frames = 0;
+
+		while (!m_buffer.empty())
+		{
+			size_t need = m_frameSize ? m_frameSize : 4;
+			size_t take = need - m_buffer.size();
+			if (take > len)
+				take = len;
+			m_buffer.insert(m_buffer.end(), input, input + take);
+			input += take;
+			len -= take;
+			if (!m_frameSize && (m_buffer.size() >= 4))
+			{
+				m_frameSize = peekFrameSize(m_buffer.data());
+				m_buffer.reserve(m_frameSize);
+				continue;
+			}
+			if (m_buffer.size() < need)
+				return frames;
+			m_handler(m_buffer.data(), m_frameSize);
+			frames++;
+			reset();
+		}
+
+		while (len >= 4)
+		{
+			uint32_t frameSize = peekFrameSize(input);
+			if (len < frameSize)
+			{
+				m_frameSize = frameSize;
+				m_buffer.reserve(frameSize);
+				break;
+			}
+			m_handler(input, frameSize);
+			frames++;
+			input += frameSize;
+			len -= frameSize;
+		}
+		m_buffer.assign(input, input + len);
+		return frames;
+	}
+
+#if !defined(_WIN32)
+	ssize_t BsonFrameReader::readFrom(int fd, size_t readSize) throw(FrameSizeException)
+	{
+		ssize_t readLen;
+		if (m_readBuffer.size() < readSize)
+			m_readBuffer.resize(readSize);
+		do {
+			readLen = ::read(fd, m_readBuffer.data(), readSize);
+		} while ((readLen < 0) && (errno == EINTR));
+		if (readLen > 0)
+			feed(m_readBuffer.data(), readLen);
+		return readLen;
+	}
+#endif
+
+	BsonFrameWriter::BsonFrameWriter(int fd, size_t chunkSize)
+		: m_sink(chunkSize)
+	{
+		m_fd = fd;
+		m_written = 0;
+	}
+
+#if !defined(_WIN32)
+	ssize_t BsonFrameWriter::flush()
+	{
+		const size_t maxIov = 64;
+		struct iovec iov[maxIov];
+		size_t total = m_sink.size();
+		size_t chunkSize = m_sink.chunkSize();
+		size_t chunkCount = m_sink.chunkCount();
+		ssize_t flushed = 0;
+
+		while (m_written < total)
+		{
+			size_t first = m_written / chunkSize;
+			size_t count = 0;
+			size_t i;
+			ssize_t writeLen;
+			for (i = first; (i < chunkCount) && (count < maxIov); i++)
+			{
+				const unsigned char *chunk;
+				size_t chunkLen;
+				size_t skip = (i == first) ? (m_written % chunkSize) : 0;
+				m_sink.getChunk(i, &chunk, &chunkLen);
+				iov[count].iov_base = (void*)(chunk + skip);
+				iov[count].iov_len = chunkLen - skip;
+				count++;
+			}
+			writeLen = ::writev(m_fd, iov, (int)count);
+			if (writeLen < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+					return flushed;
+				return -1;
+			}
+			m_written += writeLen;
+			flushed += writeLen;
+		}
+		clear();
+		return flushed;
+	}
+#endif
+
+}
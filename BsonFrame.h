@@ -0,0 +1,150 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonFrame.h
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "Serializable.h"
+#include "BsonSink.h"
+
+#include <functional>
+
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif
+
+namespace JsBsonRPC {
+
+	/**
+	 * Splits a byte stream into documents.
+	 * Every document is a frame whose length is its own leading int32, so no extra framing is put on the wire.
+	 * Complete frames found in the input are dispatched in place, only a frame split across reads is copied.
+	 */
+	class BsonFrameReader
+	{
+	public:
+		class FrameSizeException : public std::exception
+		{ };
+
+		/**
+		 * Receives one complete document. The bytes are only valid during the call.
+		 */
+		typedef std::function<void(const unsigned char *frame, uint32_t size)> FrameHandler;
+
+	private:
+		FrameHandler m_handler;
+		uint32_t m_maxFrameSize;
+		uint32_t m_frameSize;
+		std::vector<unsigned char> m_buffer;
+		std::vector<unsigned char> m_readBuffer;
+
+		uint32_t peekFrameSize(const unsigned char *data) const throw(FrameSizeException);
+
+	public:
+		BsonFrameReader(const FrameHandler &handler, uint32_t maxFrameSize = 16 * 1024 * 1024);
+
+		/**
+		 * Consumes received bytes and dispatches every frame they complete.
+		 * Throws FrameSizeException as soon as a size prefix below 5 or above the maximum is seen.
+		 * @return number of frames dispatched
+		 */
+		size_t feed(const void *data, size_t len) throw(FrameSizeException);
+
+#if !defined(_WIN32)
+		/**
+		 * Does one read() from fd and feeds what was read.
+		 * @return the result of read(): 0 at end of file, -1 with errno set on error
+		 */
+		ssize_t readFrom(int fd, size_t readSize = 65536) throw(FrameSizeException);
+#endif
+
+		/**
+		 * Bytes of an incomplete frame held between calls
+		 */
+		size_t bufferedSize() const {
+			return m_buffer.size();
+		}
+
+		/**
+		 * Drops any incomplete frame, required after the handler or feed() threw
+		 */
+		void reset() {
+			m_buffer.clear();
+			m_frameSize = 0;
+		}
+	};
+
+	/**
+	 * Queues serialized documents and writes them with as few system calls as possible.
+	 * Documents are encoded back to back into a ChunkedSink and flushed with writev().
+	 */
+	class BsonFrameWriter
+	{
+	private:
+		int m_fd;
+		ChunkedSink m_sink;
+		size_t m_written;
+
+	public:
+		BsonFrameWriter(int fd = -1, size_t chunkSize = 16384);
+
+		/**
+		 * Appends one document to the batch
+		 */
+		void add(const Serializable &object) throw(Serializable::UnavailableTypeException) {
+			object.serialize(m_sink);
+		}
+
+		/**
+		 * Bytes queued and not written yet
+		 */
+		size_t pendingSize() const {
+			return m_sink.size() - m_written;
+		}
+
+		/**
+		 * The queued bytes, for transports other than a file descriptor
+		 */
+		const ChunkedSink &sink() const {
+			return m_sink;
+		}
+
+		/**
+		 * Forgets the queued bytes, keeping the chunks for the next batch
+		 */
+		void clear() {
+			m_sink.clear();
+			m_written = 0;
+		}
+
+#if !defined(_WIN32)
+		/**
+		 * Writes the queued documents to the file descriptor.
+		 * On a non-blocking descriptor a partial write is remembered and the next flush() continues from there.
+		 * @return bytes written by this call, or -1 with errno set on error other than EINTR
+		 */
+		ssize_t flush();
+#endif
+	};
+
+}
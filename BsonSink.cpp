@@ -0,0 +1,184 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonSink.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+
+#include "BsonSink.h"
+
+#include <assert.h>
+
+namespace JsBsonRPC {
+
+	ChunkedSink::ChunkedSink(size_t chunkSize)
+	{
+		m_chunkSize = chunkSize;
+		m_currentChunk = 0;
+	}
+
+	ChunkedSink::~ChunkedSink()
+	{
+		for (std::vector<unsigned char*>::iterator iter = m_chunks.begin(); iter != m_chunks.end(); iter++)
+			delete[] (*iter);
+	}
+
+	void ChunkedSink::nextChunk()
+	{
+		size_t index = m_begin ? (m_currentChunk + 1) : 0;
+		if (index >= m_chunks.size())
+			m_chunks.push_back(new unsigned char[m_chunkSize]);
+		m_currentChunk = index;
+		m_windowOffset = index * m_chunkSize;
+		m_begin = m_chunks[index];
+		m_cur = m_begin;
+		m_end = m_begin + m_chunkSize;
+	}
+
+	void ChunkedSink::overflow(const unsigned char *data, size_t len)
+	{
+		while (len > 0)
+		{
+			size_t avail = m_end - m_cur;
+			if (avail == 0)
+			{
+				nextChunk();
+				avail = m_chunkSize;
+			}
+			if (avail > len)
+				avail = len;
+			memcpy(m_cur, data, avail);
+			m_cur += avail;
+			data += avail;
+			len -= avail;
+		}
+	}
+
+	void ChunkedSink::patch(size_t pos, const void *data, size_t len)
+	{
+		const unsigned char *src = (const unsigned char*)data;
+		assert((pos + len) <= size());
+		while (len > 0)
+		{
+			size_t chunkOffset = pos % m_chunkSize;
+			size_t part = m_chunkSize - chunkOffset;
+			if (part > len)
+				part = len;
+			memcpy(m_chunks[pos / m_chunkSize] + chunkOffset, src, part);
+			pos += part;
+			src += part;
+			len -= part;
+		}
+	}
+
+	void ChunkedSink::reserve(size_t len)
+	{
+		size_t needChunks = (size() + len + m_chunkSize - 1) / m_chunkSize;
+		while (m_chunks.size() < needChunks)
+			m_chunks.push_back(new unsigned char[m_chunkSize]);
+	}
+
+	void ChunkedSink::clear()
+	{
+		m_begin = NULL;
+		m_cur = NULL;
+		m_end = NULL;
+		m_windowOffset = 0;
+		m_currentChunk = 0;
+	}
+
+	size_t ChunkedSink::chunkCount() const
+	{
+		if (!m_begin)
+			return 0;
+		return m_currentChunk + 1;
+	}
+
+	void ChunkedSink::getChunk(size_t index, const unsigned char **pData, size_t *pLen) const
+	{
+		*pData = m_chunks[index];
+		*pLen = (index == m_currentChunk) ? (size_t)(m_cur - m_begin) : m_chunkSize;
+	}
+
+#if !defined(_WIN32)
+	size_t ChunkedSink::toIovec(struct iovec *iov, size_t maxCount) const
+	{
+		size_t count = chunkCount();
+		size_t i;
+		if (count > maxCount)
+			count = maxCount;
+		for (i = 0; i < count; i++)
+		{
+			const unsigned char *data;
+			size_t len;
+			getChunk(i, &data, &len);
+			iov[i].iov_base = (void*)data;
+			iov[i].iov_len = len;
+		}
+		return count;
+	}
+#endif
+
+	std::vector<unsigned char> &StreamSink::threadScratchBuffer()
+	{
+		static thread_local std::vector<unsigned char> scratch;
+		return scratch;
+	}
+
+	StreamSink::StreamSink(std::ostream &stream)
+		: m_stream(stream), m_scratch(threadScratchBuffer())
+	{
+		m_committed = 0;
+		m_scratch.clear();
+	}
+
+	StreamSink::~StreamSink()
+	{
+		m_scratch.clear();
+	}
+
+	void StreamSink::overflow(const unsigned char *data, size_t len)
+	{
+		m_scratch.insert(m_scratch.end(), data, data + len);
+		m_windowOffset = m_committed + m_scratch.size();
+	}
+
+	void StreamSink::patch(size_t pos, const void *data, size_t len)
+	{
+		assert(pos >= m_committed);
+		memcpy(&m_scratch[pos - m_committed], data, len);
+	}
+
+	void StreamSink::reserve(size_t len)
+	{
+		m_scratch.reserve(m_scratch.size() + len);
+	}
+
+	void StreamSink::commit()
+	{
+		if (!m_scratch.empty())
+			m_stream.write((const char*)m_scratch.data(), m_scratch.size());
+		m_committed += m_scratch.size();
+		m_scratch.clear();
+		m_windowOffset = m_committed;
+	}
+
+}
@@ -0,0 +1,293 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonSink.h
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <exception>
+
+#if !defined(_WIN32)
+#include <sys/uio.h>
+#endif
+
+namespace JsBsonRPC {
+
+	/**
+	 * Output target of serialization.
+	 * Bytes go into the window [m_cur, m_end) and overflow() is called when it is exhausted.
+	 * Document sizes are back-patched with patch() once the document is complete.
+	 */
+	class BsonSink
+	{
+	public:
+		class OverflowException : public std::exception
+		{ };
+
+	protected:
+		unsigned char *m_begin;
+		unsigned char *m_cur;
+		unsigned char *m_end;
+		size_t m_windowOffset;
+
+		BsonSink() : m_begin(NULL), m_cur(NULL), m_end(NULL), m_windowOffset(0) {}
+
+		/**
+		 * Writes bytes that did not fit in the current window
+		 */
+		virtual void overflow(const unsigned char *data, size_t len) = 0;
+
+	public:
+		virtual ~BsonSink() {}
+
+		/**
+		 * Overwrites len bytes already written at absolute position pos
+		 */
+		virtual void patch(size_t pos, const void *data, size_t len) = 0;
+
+		/**
+		 * Hint that len more bytes are about to be written
+		 */
+		virtual void reserve(size_t len) {}
+
+		/**
+		 * Called when a root document is complete and nothing before it will be patched any more
+		 */
+		virtual void commit() {}
+
+		/**
+		 * Absolute position of the next byte
+		 */
+		size_t size() const {
+			return m_windowOffset + (m_cur - m_begin);
+		}
+
+		void write(const void *data, size_t len) {
+			if ((size_t)(m_end - m_cur) >= len) {
+				if (len) {
+					memcpy(m_cur, data, len);
+					m_cur += len;
+				}
+			} else {
+				overflow((const unsigned char*)data, len);
+			}
+		}
+
+		void push_back(unsigned char c) {
+			if (m_cur != m_end)
+				*m_cur++ = c;
+			else
+				overflow(&c, 1);
+		}
+	};
+
+	/**
+	 * Appends to a std::vector, as serialize(std::vector&) always did.
+	 * Bytes are staged in a small inline window and appended to the vector when it fills, so the vector is never
+	 * grown past the bytes written and no zero filled tail is written over a second time.
+	 * finish() appends the staged bytes, and is called by the destructor.
+	 */
+	class VectorSink : public BsonSink
+	{
+	private:
+		enum { STAGING_SIZE = 4096 };
+
+		std::vector<unsigned char> &m_payload;
+		unsigned char m_staging[STAGING_SIZE];
+
+		/**
+		 * Appends the staged bytes to the vector and empties the window
+		 */
+		void flush() {
+			if (m_cur != m_begin)
+				m_payload.insert(m_payload.end(), m_begin, m_cur);
+			m_windowOffset = m_payload.size();
+			m_cur = m_begin;
+		}
+
+	protected:
+		void overflow(const unsigned char *data, size_t len) override {
+			flush();
+			if (len > STAGING_SIZE) {
+				m_payload.insert(m_payload.end(), data, data + len);
+				m_windowOffset = m_payload.size();
+			} else {
+				memcpy(m_cur, data, len);
+				m_cur += len;
+			}
+		}
+
+	public:
+		VectorSink(std::vector<unsigned char> &payload) : m_payload(payload) {
+			m_windowOffset = payload.size();
+			m_begin = m_staging;
+			m_cur = m_begin;
+			m_end = m_begin + STAGING_SIZE;
+		}
+		~VectorSink() {
+			finish();
+		}
+
+		void patch(size_t pos, const void *data, size_t len) override {
+			const unsigned char *src = (const unsigned char*)data;
+			if (pos < m_windowOffset) {
+				size_t part = std::min(len, m_windowOffset - pos);
+				memcpy(&m_payload[pos], src, part);
+				pos += part;
+				src += part;
+				len -= part;
+			}
+			if (len)
+				memcpy(m_begin + (pos - m_windowOffset), src, len);
+		}
+
+		void reserve(size_t len) override {
+			size_t need = size() + len;
+			size_t capacity = m_payload.capacity();
+			if (capacity < need)
+				m_payload.reserve(std::max(need, capacity * 2));
+		}
+
+		/**
+		 * Appends the staged bytes, leaving the vector sized to the bytes written
+		 */
+		void finish() {
+			flush();
+		}
+
+	private:
+		VectorSink(const VectorSink &obj);
+		VectorSink &operator=(const VectorSink &obj);
+	};
+
+	/**
+	 * Writes into a caller provided buffer.
+	 * Throws OverflowException when the buffer is too small, before anything is written if the size is known up front.
+	 */
+	class FixedBufferSink : public BsonSink
+	{
+	protected:
+		void overflow(const unsigned char *data, size_t len) override {
+			throw OverflowException();
+		}
+
+	public:
+		FixedBufferSink(void *buffer, size_t capacity) {
+			m_begin = (unsigned char*)buffer;
+			m_cur = m_begin;
+			m_end = m_begin + capacity;
+		}
+
+		void patch(size_t pos, const void *data, size_t len) override {
+			memcpy(m_begin + pos, data, len);
+		}
+
+		void reserve(size_t len) override {
+			if ((size_t)(m_end - m_cur) < len)
+				throw OverflowException();
+		}
+
+		const unsigned char *data() const {
+			return m_begin;
+		}
+
+		void clear() {
+			m_cur = m_begin;
+		}
+	};
+
+	/**
+	 * Writes into a chain of fixed size chunks, suitable for writev().
+	 * Chunks are kept on clear() so a long lived sink stops allocating once warmed up.
+	 */
+	class ChunkedSink : public BsonSink
+	{
+	private:
+		size_t m_chunkSize;
+		std::vector<unsigned char*> m_chunks;
+		size_t m_currentChunk;
+
+		void nextChunk();
+
+	protected:
+		void overflow(const unsigned char *data, size_t len) override;
+
+	public:
+		ChunkedSink(size_t chunkSize = 16384);
+		~ChunkedSink();
+
+		void patch(size_t pos, const void *data, size_t len) override;
+		void reserve(size_t len) override;
+
+		void clear();
+
+		size_t chunkSize() const {
+			return m_chunkSize;
+		}
+		size_t chunkCount() const;
+		void getChunk(size_t index, const unsigned char **pData, size_t *pLen) const;
+
+#if !defined(_WIN32)
+		/**
+		 * Fills iov with the written chunks and returns the number of entries used
+		 */
+		size_t toIovec(struct iovec *iov, size_t maxCount) const;
+#endif
+
+	private:
+		ChunkedSink(const ChunkedSink &obj);
+		ChunkedSink &operator=(const ChunkedSink &obj);
+	};
+
+	/**
+	 * Writes to a std::ostream.
+	 * Bytes are held in a per-thread scratch buffer until commit(), because a document size is only known at its end.
+	 * The scratch buffer keeps its capacity, so steady state serialization does not allocate.
+	 * Only one StreamSink may be in use at a time on a thread.
+	 */
+	class StreamSink : public BsonSink
+	{
+	private:
+		std::ostream &m_stream;
+		std::vector<unsigned char> &m_scratch;
+		size_t m_committed;
+
+	protected:
+		void overflow(const unsigned char *data, size_t len) override;
+
+	public:
+		StreamSink(std::ostream &stream);
+		~StreamSink();
+
+		void patch(size_t pos, const void *data, size_t len) override;
+		void reserve(size_t len) override;
+		void commit() override;
+
+		static std::vector<unsigned char> &threadScratchBuffer();
+	};
+
+}
@@ -0,0 +1,188 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonStreamParser.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+
+#include "BsonStreamParser.h"
+
+namespace JsBsonRPC {
+
+	BsonStreamParser::BsonStreamParser(Serializable *object, uint32_t maxDocumentSize)
+	{
+		m_object = object;
+		m_handler = NULL;
+		m_maxDocumentSize = maxDocumentSize;
+		reset();
+	}
+
+	BsonStreamParser::BsonStreamParser(internal::BsonParseHandler *handler, uint32_t maxDocumentSize)
+	{
+		m_object = NULL;
+		m_handler = handler;
+		m_maxDocumentSize = maxDocumentSize;
+		reset();
+	}
+
+	void BsonStreamParser::reset()
+	{
+		if (m_object)
+			m_handler = m_object->beginDeserialize(DeserializationConfig::RECYCLE_OBJECTS.isEnabled(m_object->m_deserializationConfigs));
+		m_state = STATE_HEADER;
+		m_docSize = 0;
+		m_docOffset = 0;
+		m_pending.clear();
+	}
+
+	bool BsonStreamParser::measure(const unsigned char *data, uint32_t avail, uint32_t *pSize) const
+	{
+		const unsigned char *nameEnd;
+		uint32_t valueStart;
+		uint32_t valueSize;
+		bool known;
+
+		if (m_state == STATE_HEADER)
+		{
+			*pSize = 4;
+			return true;
+		}
+
+		if (avail < 1)
+		{
+			*pSize = 1;
+			return false;
+		}
+		if (data[0] == 0)
+		{
+			*pSize = 1;
+			return true;
+		}
+
+		nameEnd = (const unsigned char*)memchr(data + 1, 0, avail - 1);
+		if (!nameEnd)
+		{
+			*pSize = avail + 1;
+			return false;
+		}
+		valueStart = (uint32_t)(nameEnd - data) + 1;
+		known = internal::elementValueSize(data[0], data + valueStart, avail - valueStart, &valueSize);
+		if (valueSize > (0xFFFFFFFFu - valueStart))
+			throw Serializable::ParseException();
+		*pSize = valueStart + valueSize;
+		return known;
+	}
+
+	uint32_t BsonStreamParser::process(const unsigned char *data, uint32_t size)
+	{
+		uint8_t type;
+		uint32_t offset;
+
+		if (m_state == STATE_HEADER)
+		{
+			memcpy(&m_docSize, data, sizeof(m_docSize));
+			// Checked before anything of the body is buffered
+			if ((m_docSize < 5) || (m_docSize > m_maxDocumentSize))
+				throw Serializable::ParseException();
+			m_docOffset = 4;
+			m_state = STATE_ELEMENT;
+			return size;
+		}
+
+		type = data[0];
+		if (type == 0)
+		{
+			if ((m_docOffset + 1) != m_docSize)
+				throw Serializable::ParseException();
+			m_docOffset++;
+			m_state = STATE_COMPLETE;
+			if (m_object)
+				m_object->endDeserialize();
+			return size;
+		}
+
+		offset = 1;
+		BsonStringView name((const char*)data + offset, strlen((const char*)data + offset));
+		offset += (uint32_t)name.length() + 1;
+		// Only the document of a Serializable can start with the compact envelope
+		internal::dispatchElement(m_handler, type, name, data, &offset, size, m_object && (m_docOffset == 4));
+		if (offset != size)
+			throw Serializable::ParseException();
+		m_docOffset += size;
+		return size;
+	}
+
+	BsonStreamParser::Status BsonStreamParser::feed(const void *data, size_t len, size_t *pConsumed) throw(Serializable::ParseException)
+	{
+		const unsigned char *input = (const unsigned char*)data;
+		size_t used = 0;
+		uint32_t need;
+		bool known;
+		internal::DecodeScope scope(m_object ? m_object->m_deserializationConfigs : DeserializationConfig::getDefaultConfigure());
+
+		while (m_state != STATE_COMPLETE)
+		{
+			uint32_t remaining = (m_state == STATE_HEADER) ? 4 : (m_docSize - m_docOffset);
+			if (m_pending.empty())
+			{
+				// Fast path: the unit is parsed straight from the caller's buffer
+				uint32_t avail = ((len - used) > remaining) ? remaining : (uint32_t)(len - used);
+				known = measure(input + used, avail, &need);
+				if (need > remaining)
+					throw Serializable::ParseException();
+				if (known && (need <= avail))
+				{
+					used += process(input + used, need);
+					continue;
+				}
+				m_pending.assign(input + used, input + used + avail);
+				used += avail;
+				break;
+			}
+			else
+			{
+				// A unit split across chunks, completed byte-exactly so nothing past it is copied
+				size_t take;
+				known = measure(m_pending.data(), (uint32_t)m_pending.size(), &need);
+				if (need > remaining)
+					throw Serializable::ParseException();
+				if (known && (need <= m_pending.size()))
+				{
+					process(m_pending.data(), need);
+					m_pending.clear();
+					continue;
+				}
+				take = need - m_pending.size();
+				if (take > (len - used))
+					take = len - used;
+				if (take == 0)
+					break;
+				m_pending.insert(m_pending.end(), input + used, input + used + take);
+				used += take;
+			}
+		}
+
+		if (pConsumed)
+			*pConsumed = used;
+		return (m_state == STATE_COMPLETE) ? STATUS_COMPLETE : STATUS_NEED_MORE;
+	}
+
+}
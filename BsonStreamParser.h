@@ -0,0 +1,109 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	BsonStreamParser.h
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ */
+#pragma once
+
+#include "Serializable.h"
+
+namespace JsBsonRPC {
+
+	/**
+	 * Resumable parser for a document that arrives in pieces.
+	 * feed() accepts chunks of any size and hands every top level element to the handler as soon as it is complete.
+	 * Only the element that is split across chunks is buffered, a nested document is passed on as one element.
+	 * A document declaring more than maxDocumentSize bytes is rejected as soon as its header arrives,
+	 * which also bounds how much of a split element can be buffered.
+	 * Members that borrow from the payload (Lazy, BsonStringView, BsonBinaryView) must not be decoded this way,
+	 * because the bytes they point to do not outlive the feed() call.
+	 */
+	class BsonStreamParser
+	{
+	public:
+		enum Status {
+			STATUS_NEED_MORE = 0,
+			STATUS_COMPLETE = 1,
+		};
+
+	private:
+		enum State {
+			STATE_HEADER,
+			STATE_ELEMENT,
+			STATE_COMPLETE,
+		};
+
+		internal::BsonParseHandler *m_handler;
+		Serializable *m_object;
+
+		State m_state;
+		uint32_t m_maxDocumentSize;
+		uint32_t m_docSize;
+		uint32_t m_docOffset;
+		std::vector<unsigned char> m_pending;
+
+		bool measure(const unsigned char *data, uint32_t avail, uint32_t *pSize) const;
+		uint32_t process(const unsigned char *data, uint32_t size);
+
+	public:
+		/**
+		 * Decodes into object. Members missing from the document keep their value, as with deserialize().
+		 */
+		BsonStreamParser(Serializable *object, uint32_t maxDocumentSize = 16 * 1024 * 1024);
+		BsonStreamParser(internal::BsonParseHandler *handler, uint32_t maxDocumentSize = 16 * 1024 * 1024);
+
+		/**
+		 * Consumes bytes of the document.
+		 * Bytes after the end of the document are not consumed, pConsumed tells how many were.
+		 * Throws ParseException on malformed input and on a document larger than maxDocumentSize.
+		 */
+		Status feed(const void *data, size_t len, size_t *pConsumed = NULL) throw(Serializable::ParseException);
+
+		/**
+		 * Starts over for the next document
+		 */
+		void reset();
+
+		bool isComplete() const {
+			return m_state == STATE_COMPLETE;
+		}
+
+		/**
+		 * Size of the document, 0 until its header has been received
+		 */
+		uint32_t documentSize() const {
+			return m_docSize;
+		}
+
+		uint32_t maxDocumentSize() const {
+			return m_maxDocumentSize;
+		}
+
+		/**
+		 * Bytes of the document consumed so far
+		 */
+		uint32_t consumedSize() const {
+			return m_docOffset + (uint32_t)m_pending.size();
+		}
+	};
+
+}
@@ -25,74 +25,361 @@
  
 #include "Serializable.h"
 
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <new>
+#include <typeinfo>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
+
 namespace JsBsonRPC {
 
-	DeserializationConfig DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES(true);
+	const DeserializationConfig DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES(ORDINAL_FAIL_ON_UNKNOWN_PROPERTIES, false);
+	const DeserializationConfig DeserializationConfig::RECYCLE_OBJECTS(ORDINAL_RECYCLE_OBJECTS, false);
 
-	DeserializationConfig::BuildContext *DeserializationConfig::getBuildContext()
-	{
-		static BuildContext *buildContext = new BuildContext();
-		return buildContext;
-	}
+	static std::atomic<int> nextRuntimeOrdinal(DeserializationConfig::FIRST_RUNTIME_ORDINAL);
 
-	DeserializationConfig::DeserializationConfig(bool defaultValue)
+	DeserializationConfig::DeserializationConfig(bool defaultValue) throw(OrdinalOutOfRangeException)
 	{
-		BuildContext *buildContext = getBuildContext();
+		int next = nextRuntimeOrdinal.load();
+		// Never advances past the end, so a failed registration does not use anything up
+		do {
+			if (next >= JSBSONRPC_MAX_DESERIALIZATION_CONFIGS)
+				throw OrdinalOutOfRangeException();
+		} while (!nextRuntimeOrdinal.compare_exchange_weak(next, next + 1));
 		this->defaultValue = defaultValue;
-		this->mask = (1 << buildContext->ordinal++);
-		buildContext->list.push_back(*this);
+		this->ordinal = next;
 	}
 
-	uint32_t DeserializationConfig::getDefaultConfigure()
+	const DeserializationConfig::Mask &DeserializationConfig::getDefaultConfigure()
 	{
-		BuildContext *buildContext = getBuildContext();
-		uint32_t mask = 0;
-		for (std::list<DeserializationConfig>::const_iterator iter = buildContext->list.begin(); iter != buildContext->list.end(); iter++)
-		{
-			mask |= iter->getMask();
-		}
-		return mask;
+		static const Mask defaults;
+		return defaults;
 	}
 
 	namespace internal {
-		int _my_itoa(
-			int    value,
-			char*  buf, \
-			size_t bufSize,
-			int    radix
-		)
-		{
-#if defined(_WIN32) && defined(_MSC_VER)
-			return _itoa_s(value, buf, bufSize, radix);
-#else
-			if (itoa(value, buf, radix))
-				return 0;
-			return 1;
-#endif
+		static thread_local DecodeContext *decodeContext = NULL;
+
+		DecodeContext *currentDecodeContext()
+		{
+			return decodeContext;
+		}
+
+		DecodeScope::DecodeScope(const DeserializationConfig::Mask &configs)
+		{
+			m_previous = decodeContext;
+			m_installed = (decodeContext == NULL);
+			if (m_installed)
+			{
+				m_context.configs = configs;
+				m_context.recycle = DeserializationConfig::RECYCLE_OBJECTS.isEnabled(configs);
+				m_context.elementOffset = 0;
+				m_context.projection = NULL;
+				m_context.arena = NULL;
+				decodeContext = &m_context;
+			}
 		}
 
-		uint32_t serializeKey(std::vector<unsigned char> &payload, const std::string& key) {
-			payload.insert(payload.end(), key.begin(), key.end());
+		DecodeScope::~DecodeScope()
+		{
+			if (m_installed)
+				decodeContext = m_previous;
+		}
+	}
+
+	namespace internal {
+		uint32_t serializeKey(BsonSink &payload, const BsonStringView &key) {
+			payload.write(key.data(), key.length());
 			payload.push_back(0);
 			return key.length() + 1;
 		}
 
-		uint32_t serializeNullObject(std::vector<unsigned char> &payload, const std::string& key)
+		/**
+		 * "0".."9999", NUL terminated, each in a fixed 5 byte slot
+		 */
+		struct IndexKeyTable {
+			enum { COUNT = 10000, SLOT = 5 };
+			char keys[COUNT * SLOT];
+			uint8_t lengths[COUNT];
+
+			IndexKeyTable() {
+				for (uint32_t index = 0; index < COUNT; index++)
+				{
+					char *key = &keys[index * SLOT];
+					uint8_t len = (uint8_t)indexKeyLength(index);
+					uint32_t value = index;
+					key[len] = 0;
+					for (int pos = len - 1; pos >= 0; pos--, value /= 10)
+						key[pos] = (char)('0' + (value % 10));
+					lengths[index] = len;
+				}
+			}
+		};
+
+		static const IndexKeyTable &indexKeyTable()
+		{
+			static const IndexKeyTable table;
+			return table;
+		}
+
+		BsonStringView indexKey(uint32_t index, IndexKeyBuffer &buf)
+		{
+			char *end;
+			char *begin;
+			if (index < IndexKeyTable::COUNT)
+			{
+				const IndexKeyTable &table = indexKeyTable();
+				return BsonStringView(&table.keys[index * IndexKeyTable::SLOT], table.lengths[index]);
+			}
+			end = buf + sizeof(buf) - 1;
+			begin = end;
+			*end = 0;
+			do {
+				*--begin = (char)('0' + (index % 10));
+				index /= 10;
+			} while (index);
+			return BsonStringView(begin, end - begin);
+		}
+
+		static const char METADATA_NAME_KEY[] = "@jsbsonrpcsname";
+		static const char METADATA_VERSION_KEY[] = "@jsbsonrpcsver";
+		static const char METADATA_TYPEID_KEY[] = "@t";
+
+		/**
+		 * Reads the cstring name of an element, returning a view into the payload
+		 */
+		static BsonStringView readElementName(const unsigned char *payload, uint32_t *offset, uint32_t docEndPos)
+		{
+			const char *begin;
+			const char *end;
+			if (*offset >= docEndPos)
+				throw Serializable::ParseException();
+			begin = (const char*)payload + *offset;
+			end = (const char*)memchr(begin, 0, docEndPos - *offset);
+			if (!end)
+				throw Serializable::ParseException();
+			*offset += (uint32_t)(end - begin) + 1;
+			return BsonStringView(begin, end - begin);
+		}
+
+		/**
+		 * All metadata keys begin with '@' which is rare in member names, so most elements are rejected by one compare
+		 */
+		static inline bool isMetadataName(const BsonStringView &name, const char *key, size_t keyLen)
+		{
+			return (name.length() == keyLen) && (name.data()[0] == '@') && name.equals(key, keyLen);
+		}
+
+		uint32_t serializeNullObject(BsonSink &payload, const BsonStringView &key)
 		{
 			uint32_t payloadLen = 1;
-			int i;
 			payload.push_back(BSONTYPE_NULL);
 			payloadLen += serializeKey(payload, key);
 			return payloadLen;
 		}
+
+		/**
+		 * Open addressing hash table from member name to slot index.
+		 * Built once per concrete Serializable class, from its schema or from the first instance that parses.
+		 */
+		class MemberLookupTable
+		{
+		private:
+			struct Slot {
+				uint32_t hash;
+				int index; // -1 : empty
+			};
+			std::vector<Slot> m_slots;
+			std::vector<std::string> m_names;
+			uint32_t m_mask;
+
+		public:
+			static uint32_t hashName(const char *name, size_t len)
+			{
+				// FNV-1a
+				uint32_t hash = 2166136261u;
+				for (size_t i = 0; i < len; i++)
+				{
+					hash ^= (unsigned char)name[i];
+					hash *= 16777619u;
+				}
+				return hash;
+			}
+
+			MemberLookupTable(const std::vector<std::string> &names)
+			{
+				uint32_t capacity = 4;
+				while (capacity < names.size() * 2)
+					capacity <<= 1;
+				Slot empty = { 0, -1 };
+				m_slots.assign(capacity, empty);
+				m_names = names;
+				m_mask = capacity - 1;
+				for (size_t i = 0; i < names.size(); i++)
+				{
+					const std::string &name = names[i];
+					// The first registration wins on duplicated names, as the linear scan did
+					if (find(name.data(), name.length()) >= 0)
+						continue;
+					uint32_t hash = hashName(name.data(), name.length());
+					uint32_t pos = hash & m_mask;
+					while (m_slots[pos].index >= 0)
+						pos = (pos + 1) & m_mask;
+					m_slots[pos].hash = hash;
+					m_slots[pos].index = (int)i;
+				}
+			}
+
+			int find(const char *name, size_t len) const
+			{
+				uint32_t hash = hashName(name, len);
+				for (uint32_t pos = hash & m_mask; ; pos = (pos + 1) & m_mask)
+				{
+					const Slot &slot = m_slots[pos];
+					if (slot.index < 0)
+						return -1;
+					if (slot.hash == hash)
+					{
+						const std::string &memberName = m_names[slot.index];
+						if ((memberName.length() == len) && (memcmp(memberName.data(), name, len) == 0))
+							return slot.index;
+					}
+				}
+			}
+		};
+
+		/**
+		 * Member tables of the classes declared with serializableMapMember, by concrete type.
+		 * Each table is built once, from the first instance that needs it. Readers look it up in the current
+		 * snapshot without locking, writers publish a copy of the snapshot with the new table added.
+		 */
+		class MemberLookupTables
+		{
+		private:
+			typedef std::unordered_map<std::type_index, const MemberLookupTable*> Snapshot;
+
+			std::mutex m_mutex;
+			std::atomic<const Snapshot*> m_current;
+			std::vector<std::unique_ptr<Snapshot> > m_snapshots;
+			std::vector<std::unique_ptr<MemberLookupTable> > m_tables;
+
+		public:
+			MemberLookupTables() : m_current(NULL) {
+				m_snapshots.emplace_back(new Snapshot());
+				m_current = m_snapshots.back().get();
+			}
+
+			static MemberLookupTables &instance() {
+				static MemberLookupTables tables;
+				return tables;
+			}
+
+			const MemberLookupTable *get(const std::type_info &type, const std::vector<STypeCommon*> &members) {
+				const Snapshot *snapshot = m_current.load(std::memory_order_acquire);
+				Snapshot::const_iterator iter = snapshot->find(std::type_index(type));
+				if (iter != snapshot->end())
+					return iter->second;
+
+				std::lock_guard<std::mutex> lock(m_mutex);
+				snapshot = m_current.load(std::memory_order_relaxed);
+				iter = snapshot->find(std::type_index(type));
+				if (iter != snapshot->end())
+					return iter->second;
+				std::vector<std::string> names;
+				for (size_t i = 0; i < members.size(); i++)
+					names.push_back(members[i]->getMemberName());
+				m_tables.emplace_back(new MemberLookupTable(names));
+				// Retired snapshots are kept alive because a reader may still be using one
+				m_snapshots.emplace_back(new Snapshot(*snapshot));
+				(*m_snapshots.back())[std::type_index(type)] = m_tables.back().get();
+				m_current.store(m_snapshots.back().get(), std::memory_order_release);
+				return m_tables.back().get();
+			}
+		};
+	}
+
+	SerializableSchema::SerializableSchema(const char *name, int64_t serialVersionUID, std::initializer_list<internal::SchemaField> fields)
+		: m_name(name), m_serialVersionUID(serialVersionUID), m_fields(fields)
+	{
+		std::vector<std::string> names;
+		for (size_t i = 0; i < m_fields.size(); i++)
+			names.push_back(m_fields[i].name);
+		m_lookupTable = new internal::MemberLookupTable(names);
+	}
+
+	SerializableSchema::~SerializableSchema()
+	{
+		delete m_lookupTable;
+	}
+
+	int SerializableSchema::findField(const BsonStringView &name) const
+	{
+		return m_lookupTable->find(name.data(), name.length());
 	}
 
 	Serializable::Serializable(const char *name, int64_t serialVersionUID)
 	{
 		m_name = name;
 		m_serialVersionUID = serialVersionUID;
+		m_memberLookupTable = NULL;
+		m_parseCursor = 0;
+		m_schema = NULL;
+		m_schemaCursor = 0;
+		m_deserializationConfigs = DeserializationConfig::getDefaultConfigure();
+		m_envelopeTypeId = -1;
+		m_envelopeGeneration = 0;
+		m_recycling = false;
+		m_projection = NULL;
+		m_fragmentCache = false;
+		m_fragmentGeneration = 0;
+	}
+
+	Serializable::Serializable(const SerializableSchema &schema)
+	{
+		m_serialVersionUID = schema.serialVersionUID();
+		m_memberLookupTable = NULL;
+		m_parseCursor = 0;
+		m_schema = &schema;
+		m_schemaCursor = 0;
 		m_deserializationConfigs = DeserializationConfig::getDefaultConfigure();
+		m_envelopeTypeId = -1;
+		m_envelopeGeneration = 0;
+		m_recycling = false;
+		m_projection = NULL;
+		m_fragmentCache = false;
+		m_fragmentGeneration = 0;
+	}
+
+#if (__cplusplus >= 201103) || (__cplusplus == 199711) || (defined(HAS_MOVE_SEMANTICS) && HAS_MOVE_SEMANTICS == 1)
+	Serializable::Serializable(Serializable&& _ref)
+		: m_name(_ref.m_name)
+	{
+		const char *source = (const char*)&_ref;
+		m_serialVersionUID = _ref.m_serialVersionUID;
+		m_memberLookupTable = _ref.m_memberLookupTable;
+		m_parseCursor = 0;
+		m_schema = _ref.m_schema;
+		m_schemaCursor = 0;
+		m_deserializationConfigs = _ref.m_deserializationConfigs;
+		m_envelopeTypeId = -1;
+		m_envelopeGeneration = 0;
+		m_recycling = false;
+		m_projection = NULL;
+		// The cached fragments stay with _ref, the moved members are encoded again on the first serialize
+		m_fragmentCache = _ref.m_fragmentCache;
+		m_fragmentGeneration = 0;
+		for (std::vector<internal::STypeCommon*>::const_iterator iter = _ref.m_memberSlots.begin(); iter != _ref.m_memberSlots.end(); iter++)
+		{
+			internal::STypeCommon *member = (internal::STypeCommon*)((char*)this + ((const char*)(*iter) - source));
+			m_members.push_back(member);
+			m_memberSlots.push_back(member);
+		}
 	}
+#endif
 
 	Serializable::~Serializable()
 	{
@@ -100,212 +387,1113 @@ namespace JsBsonRPC {
 
 	void Serializable::serializableConfigure(const DeserializationConfig &deserializationConfig, bool enable)
 	{
-		if (enable)
-			m_deserializationConfigs |= deserializationConfig.getMask();
-		else
-			m_deserializationConfigs &= ~deserializationConfig.getMask();
+		deserializationConfig.configure(m_deserializationConfigs, enable);
 	}
 
 	internal::STypeCommon &Serializable::serializableMapMember(const char *name, internal::STypeCommon &object)
 	{
 		object.setMemberName(name);
 		m_members.push_back(&object);
+		m_memberSlots.push_back(&object);
+		m_memberLookupTable = NULL;
 		return object;
 	}
 
 	void Serializable::serializableClearObjects()
 	{
+		if (m_schema)
+		{
+			const std::vector<internal::SchemaField> &fields = m_schema->fields();
+			for (size_t i = 0; i < fields.size(); i++)
+				fields[i].clear(this);
+		}
 		for (std::list<internal::STypeCommon*>::const_iterator iter = m_members.begin(); iter != m_members.end(); iter++)
 		{
 			(*iter)->clear();
 		}
 	}
 
-	size_t Serializable::serialize(std::vector<unsigned char>& payload) const throw(UnavailableTypeException)
+	namespace internal {
+		/**
+		 * Process wide table of Serializable classes, by (name, serialVersionUID) and by compact type id.
+		 * Readers load the current snapshot without locking. Writers copy it, modify the copy and publish it,
+		 * and retired snapshots are kept alive because a reader may still be using one.
+		 */
+		class TypeRegistry
+		{
+		public:
+			struct Entry {
+				const std::string *name; // interned
+				int64_t serialVersionUID;
+				SerializableRegistry::CreateFunction create;
+				int32_t typeId; // -1 : none
+			};
+
+			struct Snapshot {
+				std::vector<Entry> entries;
+				std::unordered_multimap<uint32_t, const Entry*> byType;
+				std::unordered_map<int32_t, const Entry*> byId;
+			};
+
+		private:
+			std::mutex m_mutex;
+			std::unordered_set<std::string> m_names;
+			std::atomic<const Snapshot*> m_current;
+			std::vector<Snapshot*> m_snapshots;
+
+		public:
+			std::atomic<bool> compact;
+			std::atomic<uint32_t> generation;
+
+			TypeRegistry() : m_current(NULL), compact(false), generation(1) {
+				Snapshot *snapshot = new Snapshot();
+				m_snapshots.push_back(snapshot);
+				m_current = snapshot;
+			}
+			~TypeRegistry() {
+				for (std::vector<Snapshot*>::iterator iter = m_snapshots.begin(); iter != m_snapshots.end(); iter++)
+					delete (*iter);
+			}
+
+			static TypeRegistry &instance() {
+				static TypeRegistry registry;
+				return registry;
+			}
+
+			static uint32_t hashType(const BsonStringView &name, int64_t serialVersionUID) {
+				return MemberLookupTable::hashName(name.data(), name.length()) ^ (uint32_t)(serialVersionUID ^ (serialVersionUID >> 32));
+			}
+
+			const Snapshot *snapshot() const {
+				return m_current.load(std::memory_order_acquire);
+			}
+
+			static const Entry *findType(const Snapshot *snapshot, const BsonStringView &name, int64_t serialVersionUID) {
+				typedef std::unordered_multimap<uint32_t, const Entry*>::const_iterator Iter;
+				std::pair<Iter, Iter> range = snapshot->byType.equal_range(hashType(name, serialVersionUID));
+				for (Iter iter = range.first; iter != range.second; iter++)
+				{
+					const Entry *entry = iter->second;
+					if ((entry->serialVersionUID == serialVersionUID) && (name == *entry->name))
+						return entry;
+				}
+				return NULL;
+			}
+
+			static const Entry *findId(const Snapshot *snapshot, int32_t typeId) {
+				std::unordered_map<int32_t, const Entry*>::const_iterator iter = snapshot->byId.find(typeId);
+				if (iter == snapshot->byId.end())
+					return NULL;
+				return iter->second;
+			}
+
+			/**
+			 * Sets the constructor and/or the type id of a type, a NULL create or a negative typeId keeps the current one
+			 */
+			void update(const std::string &name, int64_t serialVersionUID, SerializableRegistry::CreateFunction create, int32_t typeId) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				Snapshot *next = new Snapshot(*snapshot());
+				size_t index;
+
+				for (index = 0; index < next->entries.size(); index++)
+				{
+					if ((next->entries[index].serialVersionUID == serialVersionUID) && (*next->entries[index].name == name))
+						break;
+				}
+				if (index == next->entries.size())
+				{
+					Entry entry;
+					entry.name = &(*m_names.insert(name).first);
+					entry.serialVersionUID = serialVersionUID;
+					entry.create = NULL;
+					entry.typeId = -1;
+					next->entries.push_back(entry);
+				}
+
+				if (create)
+					next->entries[index].create = create;
+				if (typeId >= 0)
+				{
+					for (std::vector<Entry>::iterator iter = next->entries.begin(); iter != next->entries.end(); iter++)
+					{
+						if (iter->typeId == typeId)
+							iter->typeId = -1;
+					}
+					next->entries[index].typeId = typeId;
+				}
+
+				next->byType.clear();
+				next->byId.clear();
+				for (std::vector<Entry>::const_iterator iter = next->entries.begin(); iter != next->entries.end(); iter++)
+				{
+					next->byType.insert(std::make_pair(hashType(*iter->name, iter->serialVersionUID), &(*iter)));
+					if (iter->typeId >= 0)
+						next->byId[iter->typeId] = &(*iter);
+				}
+
+				m_snapshots.push_back(next);
+				m_current.store(next, std::memory_order_release);
+				generation++;
+			}
+		};
+	}
+
+	void SerializableRegistry::registerType(const std::string &name, int64_t serialVersionUID, CreateFunction create)
+	{
+		internal::TypeRegistry::instance().update(name, serialVersionUID, create, -1);
+	}
+
+	Serializable *SerializableRegistry::create(const BsonStringView &name, int64_t serialVersionUID)
+	{
+		internal::TypeRegistry &registry = internal::TypeRegistry::instance();
+		const internal::TypeRegistry::Entry *entry = internal::TypeRegistry::findType(registry.snapshot(), name, serialVersionUID);
+		if (!entry || !entry->create)
+			return NULL;
+		return entry->create();
+	}
+
+	bool SerializableRegistry::isRegistered(const BsonStringView &name, int64_t serialVersionUID)
+	{
+		internal::TypeRegistry &registry = internal::TypeRegistry::instance();
+		const internal::TypeRegistry::Entry *entry = internal::TypeRegistry::findType(registry.snapshot(), name, serialVersionUID);
+		return entry && entry->create;
+	}
+
+	void SerializableTypeIds::registerType(int32_t typeId, const std::string &name, int64_t serialVersionUID)
+	{
+		assert(typeId >= 0);
+		internal::TypeRegistry::instance().update(name, serialVersionUID, NULL, typeId);
+	}
+
+	void SerializableTypeIds::setCompactEnvelope(bool enable)
+	{
+		internal::TypeRegistry &registry = internal::TypeRegistry::instance();
+		registry.compact = enable;
+		registry.generation++;
+	}
+
+	bool SerializableTypeIds::isCompactEnvelope()
+	{
+		return internal::TypeRegistry::instance().compact;
+	}
+
+	bool SerializableTypeIds::findTypeId(const std::string &name, int64_t serialVersionUID, int32_t *pTypeId)
+	{
+		internal::TypeRegistry &registry = internal::TypeRegistry::instance();
+		const internal::TypeRegistry::Entry *entry = internal::TypeRegistry::findType(registry.snapshot(), name, serialVersionUID);
+		if (!entry || (entry->typeId < 0))
+			return false;
+		if (pTypeId)
+			*pTypeId = entry->typeId;
+		return true;
+	}
+
+	bool SerializableTypeIds::findType(int32_t typeId, std::string *pName, int64_t *pSerialVersionUID)
+	{
+		internal::TypeRegistry &registry = internal::TypeRegistry::instance();
+		const internal::TypeRegistry::Entry *entry = internal::TypeRegistry::findId(registry.snapshot(), typeId);
+		if (!entry)
+			return false;
+		if (pName)
+			*pName = *entry->name;
+		if (pSerialVersionUID)
+			*pSerialVersionUID = entry->serialVersionUID;
+		return true;
+	}
+
+	uint32_t SerializableTypeIds::generation()
+	{
+		return internal::TypeRegistry::instance().generation;
+	}
+
+	int32_t Serializable::envelopeTypeId() const
+	{
+		uint32_t generation = SerializableTypeIds::generation();
+		if (m_envelopeGeneration != generation)
+		{
+			int32_t typeId = -1;
+			if (!SerializableTypeIds::isCompactEnvelope() || !SerializableTypeIds::findTypeId(serializableNameRef(), m_serialVersionUID, &typeId))
+				typeId = -1;
+			m_envelopeTypeId = typeId;
+			m_envelopeGeneration = generation;
+		}
+		return m_envelopeTypeId;
+	}
+
+	uint32_t Serializable::serializedSize() const
+	{
+		uint32_t totalSize = 5;
+		int32_t typeId = envelopeTypeId();
+		if (typeId >= 0)
+		{
+			totalSize += internal::ObjectHelper<0, int32_t>::serializedSize(sizeof(internal::METADATA_TYPEID_KEY) - 1, typeId);
+		}
+		else
+		{
+			totalSize += internal::ObjectHelper<0, std::string>::serializedSize(sizeof(internal::METADATA_NAME_KEY) - 1, serializableNameRef());
+			totalSize += internal::ObjectHelper<0, int64_t>::serializedSize(sizeof(internal::METADATA_VERSION_KEY) - 1, this->m_serialVersionUID);
+		}
+		if (m_fragmentCache)
+			return totalSize + fragmentsSize();
+		if (m_schema)
+		{
+			const std::vector<internal::SchemaField> &fields = m_schema->fields();
+			for (size_t i = 0; i < fields.size(); i++)
+				totalSize += fields[i].serializedSize(this, fields[i].name);
+		}
+		for (std::list<internal::STypeCommon*>::const_iterator iterMem = m_members.begin(); iterMem != m_members.end(); iterMem++)
+		{
+			totalSize += (*iterMem)->serializedSize();
+		}
+		return totalSize;
+	}
+
+	void Serializable::serializableEnableFragmentCache(bool enable)
+	{
+		m_fragmentCache = enable;
+		m_fragments.clear();
+	}
+
+	void Serializable::validateFragments() const
+	{
+		size_t count = (m_schema ? m_schema->fields().size() : 0) + m_memberSlots.size();
+		uint32_t generation = SerializableTypeIds::generation();
+		// Cached nested documents carry envelopes, which depend on the type id registry
+		if ((m_fragments.size() != count) || (m_fragmentGeneration != generation))
+		{
+			m_fragments.clear();
+			m_fragments.resize(count);
+			m_fragmentGeneration = generation;
+		}
+	}
+
+	const internal::STypeCommon *Serializable::fragmentMember(size_t index) const
+	{
+		size_t schemaCount = m_schema ? m_schema->fields().size() : 0;
+		if (index < schemaCount)
+			return m_schema->fields()[index].member(this);
+		return m_memberSlots[index - schemaCount];
+	}
+
+	uint32_t Serializable::fragmentsSize() const
+	{
+		size_t schemaCount = m_schema ? m_schema->fields().size() : 0;
+		uint32_t totalSize = 0;
+		validateFragments();
+		for (size_t i = 0; i < m_fragments.size(); i++)
+		{
+			const internal::STypeCommon *member = fragmentMember(i);
+			if (!member->isDirty() && !m_fragments[i].empty())
+				totalSize += (uint32_t)m_fragments[i].size();
+			else if (i < schemaCount)
+				totalSize += m_schema->fields()[i].serializedSize(this, m_schema->fields()[i].name);
+			else
+				totalSize += member->serializedSize();
+		}
+		return totalSize;
+	}
+
+	uint32_t Serializable::serializeFragments(BsonSink &payload) const
+	{
+		size_t schemaCount = m_schema ? m_schema->fields().size() : 0;
+		uint32_t totalSize = 0;
+		validateFragments();
+		for (size_t i = 0; i < m_fragments.size(); i++)
+		{
+			const internal::STypeCommon *member = fragmentMember(i);
+			std::vector<unsigned char> &fragment = m_fragments[i];
+			if (!member->isFragmentCacheable())
+			{
+				totalSize += (i < schemaCount) ? m_schema->fields()[i].serialize(this, payload, m_schema->fields()[i].name) : member->serialize(payload);
+				continue;
+			}
+			if (member->isDirty() || fragment.empty())
+			{
+				fragment.clear();
+				VectorSink sink(fragment);
+				if (i < schemaCount)
+					m_schema->fields()[i].serialize(this, sink, m_schema->fields()[i].name);
+				else
+					member->serialize(sink);
+				member->markClean();
+			}
+			payload.write(fragment.data(), fragment.size());
+			totalSize += (uint32_t)fragment.size();
+		}
+		return totalSize;
+	}
+
+	size_t Serializable::serialize(BsonSink& payload) const throw(UnavailableTypeException, BsonSink::OverflowException)
+	{
+		size_t payloadLen;
+		payload.reserve(serializedSize());
+		payloadLen = serializeTo(payload);
+		payload.commit();
+		return payloadLen;
+	}
+
+	size_t Serializable::serializeTo(BsonSink& payload) const throw(UnavailableTypeException, BsonSink::OverflowException)
 	{
 		size_t offset = 0;
 		offset = payload.size();
 		// DOCUMENT HEADER : SIZE
-		payload.push_back(0);
-		payload.push_back(0);
-		payload.push_back(0);
-		payload.push_back(0);
+		internal::writeValue<uint32_t>(payload, 0);
 		uint32_t totalSize = 5;
 
-		totalSize += internal::ObjectHelper<0, std::string>::serialize(payload, "@jsbsonrpcsname", this->m_name);
-		totalSize += internal::ObjectHelper<0, int64_t>::serialize(payload, "@jsbsonrpcsver", this->m_serialVersionUID);
+		int32_t typeId = envelopeTypeId();
+		if (typeId >= 0)
+		{
+			totalSize += internal::ObjectHelper<0, int32_t>::serialize(payload, internal::METADATA_TYPEID_KEY, typeId);
+		}
+		else
+		{
+			totalSize += internal::ObjectHelper<0, std::string>::serialize(payload, internal::METADATA_NAME_KEY, serializableNameRef());
+			totalSize += internal::ObjectHelper<0, int64_t>::serialize(payload, internal::METADATA_VERSION_KEY, this->m_serialVersionUID);
+		}
 
-		for (std::list<internal::STypeCommon*>::const_iterator iterMem = m_members.begin(); iterMem != m_members.end(); iterMem++)
+		if (m_fragmentCache)
+		{
+			totalSize += serializeFragments(payload);
+		}
+		else
 		{
-			const internal::STypeCommon *stypeCommon = *iterMem;
-			totalSize += stypeCommon->serialize(payload);
+			if (m_schema)
+			{
+				const std::vector<internal::SchemaField> &fields = m_schema->fields();
+				for (size_t i = 0; i < fields.size(); i++)
+					totalSize += fields[i].serialize(this, payload, fields[i].name);
+			}
+
+			for (std::list<internal::STypeCommon*>::const_iterator iterMem = m_members.begin(); iterMem != m_members.end(); iterMem++)
+			{
+				const internal::STypeCommon *stypeCommon = *iterMem;
+				totalSize += stypeCommon->serialize(payload);
+			}
 		}
 		// DOCUMENT FOOTER : END
 		payload.push_back(0);
-		payload[offset + 0] = ((unsigned char)(totalSize >> 0));
-		payload[offset + 1] = ((unsigned char)(totalSize >> 8));
-		payload[offset + 2] = ((unsigned char)(totalSize >> 16));
-		payload[offset + 3] = ((unsigned char)(totalSize >> 24));
+		internal::patchValue<uint32_t>(payload, offset, totalSize);
 		return payload.size() - offset;
 	}
 
-	size_t Serializable::deserialize(const std::vector<unsigned char>& payload, size_t offset) throw (ParseException)
+	size_t Serializable::deserialize(const uint8_t *data, size_t len, size_t offset) throw (ParseException)
 	{
 		uint32_t tempOffset = offset;
-		internal::BsonParser parser(payload, payload.size(), &tempOffset, m_deserializationConfigs);
-		return parser.parse(this);
+		uint32_t docSize;
+		internal::DecodeScope scope(m_deserializationConfigs);
+		if (len > 0xFFFFFFFFu)
+			throw ParseException();
+		internal::BsonParser parser(data, len, &tempOffset, m_deserializationConfigs, true);
+		docSize = parser.parse(beginDeserialize(internal::isRecycling()));
+		endDeserialize();
+		return docSize;
 	}
 
-	bool Serializable::bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos)
+	size_t Serializable::deserialize(const uint8_t *data, size_t len, const BsonProjection &projection, size_t offset) throw (ParseException)
 	{
-		for (std::list<internal::STypeCommon*>::const_iterator iterMem = m_members.begin(); iterMem != m_members.end(); iterMem++)
+		internal::DecodeScope scope(m_deserializationConfigs);
+		internal::DecodeContext *context = internal::currentDecodeContext();
+		const BsonProjection *previous = context->projection;
+		size_t docSize;
+		context->projection = projection.includesAll() ? NULL : &projection;
+		try {
+			docSize = deserialize(data, len, offset);
+		} catch (...) {
+			context->projection = previous;
+			throw;
+		}
+		context->projection = previous;
+		return docSize;
+	}
+
+	size_t Serializable::deserialize(const uint8_t *data, size_t len, BsonArena &arena, size_t offset) throw (ParseException)
+	{
+		internal::DecodeScope scope(m_deserializationConfigs);
+		internal::DecodeContext *context = internal::currentDecodeContext();
+		BsonArena *previous = context->arena;
+		size_t docSize;
+		context->arena = &arena;
+		try {
+			docSize = deserialize(data, len, offset);
+		} catch (...) {
+			context->arena = previous;
+			throw;
+		}
+		context->arena = previous;
+		return docSize;
+	}
+
+	BsonProjection::BsonProjection(std::initializer_list<std::string> paths)
+	{
+		m_all = false;
+		for (std::initializer_list<std::string>::const_iterator iter = paths.begin(); iter != paths.end(); iter++)
+			add(*iter);
+	}
+
+	BsonProjection &BsonProjection::add(const std::string &path)
+	{
+		size_t dot = path.find('.');
+		std::string name = path.substr(0, dot);
+		BsonProjection *child = NULL;
+		if (m_all)
+			return *this;
+		for (size_t i = 0; i < m_names.size(); i++)
+		{
+			if (m_names[i] == name)
+				child = &m_children[i];
+		}
+		if (!child)
+		{
+			m_names.push_back(name);
+			m_children.push_back(BsonProjection());
+			child = &m_children.back();
+		}
+		if (dot == std::string::npos)
+		{
+			child->m_all = true;
+			child->m_names.clear();
+			child->m_children.clear();
+		}
+		else
+		{
+			child->add(path.substr(dot + 1));
+		}
+		return *this;
+	}
+
+	const BsonProjection *BsonProjection::find(const BsonStringView &name) const
+	{
+		for (size_t i = 0; i < m_names.size(); i++)
+		{
+			if (name.equals(m_names[i].data(), m_names[i].length()))
+				return &m_children[i];
+		}
+		return NULL;
+	}
+
+	internal::BsonParseHandler *Serializable::beginDeserialize(bool recycle)
+	{
+		m_parseCursor = 0;
+		m_schemaCursor = 0;
+		m_recycling = recycle;
+		m_projection = NULL;
+		if (internal::currentDecodeContext())
+			m_projection = internal::currentDecodeContext()->projection;
+		if (recycle)
+			m_recycleSeen.assign((m_schema ? m_schema->fields().size() : 0) + m_memberSlots.size(), 0);
+		return this;
+	}
+
+	void Serializable::endDeserialize()
+	{
+		size_t schemaCount;
+		if (!m_recycling)
+			return;
+		m_recycling = false;
+		// Members outside a projection are left as they are
+		if (m_projection)
+			return;
+		schemaCount = m_schema ? m_schema->fields().size() : 0;
+		for (size_t i = 0; i < schemaCount; i++)
+		{
+			if (!m_recycleSeen[i])
+				m_schema->fields()[i].clear(this);
+		}
+		for (size_t i = 0; i < m_memberSlots.size(); i++)
 		{
-			internal::STypeCommon *stypeCommon = (*iterMem);
-			if (stypeCommon->getMemberName() == name)
+			if (!m_recycleSeen[schemaCount + i])
+				m_memberSlots[i]->clear();
+		}
+	}
+
+	DecodeStatus Serializable::tryDeserialize(const uint8_t *data, size_t len, size_t offset, size_t *pDocSize) throw()
+	{
+		DecodeStatus status;
+		internal::DecodeContext *context;
+		if ((len > 0xFFFFFFFFu) || !internal::validateDocument(data, len, offset, &status))
+		{
+			if (status.ok())
+				status.kind = DecodeStatus::DECODE_BAD_SIZE;
+			return status;
+		}
+
+		internal::DecodeScope scope(m_deserializationConfigs);
+		context = internal::currentDecodeContext();
+		try {
+			size_t docSize = deserialize(data, len, offset);
+			if (pDocSize)
+				*pDocSize = docSize;
+			return status;
+		} catch (const std::bad_alloc &) {
+			status.kind = DecodeStatus::DECODE_OUT_OF_MEMORY;
+		} catch (...) {
+			status.kind = DecodeStatus::DECODE_REJECTED;
+		}
+		status.offset = context->elementOffset;
+		try {
+			status.path = internal::elementPathAt(data, len, offset, status.offset);
+		} catch (...) {
+		}
+		return status;
+	}
+
+	const char *DecodeStatus::kindName(ErrorKind kind)
+	{
+		switch (kind)
+		{
+		case DECODE_OK: return "ok";
+		case DECODE_TRUNCATED: return "truncated";
+		case DECODE_BAD_SIZE: return "bad document size";
+		case DECODE_BAD_TERMINATOR: return "bad document terminator";
+		case DECODE_BAD_STRING: return "bad string";
+		case DECODE_UNKNOWN_TYPE: return "unknown element type";
+		case DECODE_UNKNOWN_TYPE_ID: return "unknown type id";
+		case DECODE_TOO_DEEP: return "nested too deep";
+		case DECODE_REJECTED: return "rejected by member";
+		case DECODE_OUT_OF_MEMORY: return "out of memory";
+		}
+		return "unknown";
+	}
+
+	Serializable *Serializable::decodeAny(const uint8_t *data, size_t len, size_t offset, size_t *pDocSize) throw (ParseException)
+	{
+		std::string sname;
+		int64_t sver;
+		Serializable *object;
+		size_t docSize;
+		if (!readMetadata(data, len, offset, &sname, &sver))
+			return NULL;
+		object = SerializableRegistry::create(sname, sver);
+		if (!object)
+			return NULL;
+		try {
+			docSize = object->deserialize(data, len, offset);
+		} catch (...) {
+			delete object;
+			throw;
+		}
+		if (pDocSize)
+			*pDocSize = docSize;
+		return object;
+	}
+
+	internal::STypeCommon *Serializable::findMember(const BsonStringView &name)
+	{
+		int index;
+
+		if (m_memberSlots.empty())
+			return NULL;
+
+		if (m_parseCursor < m_memberSlots.size())
+		{
+			internal::STypeCommon *expected = m_memberSlots[m_parseCursor];
+			if (name == expected->getMemberName())
+			{
+				m_parseCursor++;
+				return expected;
+			}
+		}
+
+		if (!m_memberLookupTable)
+			m_memberLookupTable = internal::MemberLookupTables::instance().get(typeid(*this), m_memberSlots);
+
+		// The table comes from the first instance of the class, and another instance may have registered
+		// different members or the same ones in another order. A slot is used only if its name matches here,
+		// anything else, a miss included, is settled by a scan of this instance's own members.
+		index = m_memberLookupTable->find(name.data(), name.length());
+		if ((index < 0) || ((size_t)index >= m_memberSlots.size()) || (name != m_memberSlots[index]->getMemberName()))
+		{
+			for (size_t i = 0; i < m_memberSlots.size(); i++)
 			{
-				stypeCommon->deserialize(type, payload, offset, docEndPos);
+				if (name == m_memberSlots[i]->getMemberName())
+				{
+					m_parseCursor = i + 1;
+					return m_memberSlots[i];
+				}
+			}
+			return NULL;
+		}
+		m_parseCursor = index + 1;
+		return m_memberSlots[index];
+	}
+
+	int Serializable::findSchemaField(const BsonStringView &name)
+	{
+		const std::vector<internal::SchemaField> &fields = m_schema->fields();
+		int index;
+
+		if ((m_schemaCursor < fields.size()) && (name == fields[m_schemaCursor].name))
+			return (int)(m_schemaCursor++);
+
+		index = m_schema->findField(name);
+		if (index >= 0)
+			m_schemaCursor = index + 1;
+		return index;
+	}
+
+	bool Serializable::bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos)
+	{
+		const BsonProjection *selected;
+		internal::DecodeContext *context;
+		bool handled;
+
+		if (!m_projection)
+			return deserializeMember(type, name, payload, offset, docEndPos);
+
+		selected = m_projection->find(name);
+		if (!selected)
+			return false;
+		context = internal::currentDecodeContext();
+		context->projection = selected->includesAll() ? NULL : selected;
+		try {
+			handled = deserializeMember(type, name, payload, offset, docEndPos);
+		} catch (...) {
+			context->projection = m_projection;
+			throw;
+		}
+		context->projection = m_projection;
+		return handled;
+	}
+
+	bool Serializable::deserializeMember(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos)
+	{
+		internal::STypeCommon *stypeCommon;
+
+		if (m_schema)
+		{
+			int index = findSchemaField(name);
+			if (index >= 0)
+			{
+				if (m_recycling)
+					m_recycleSeen[index] = 1;
+				m_schema->fields()[index].deserialize(this, type, payload, offset, docEndPos);
 				return true;
 			}
 		}
-		return false;
+
+		stypeCommon = findMember(name);
+		if (!stypeCommon)
+		{
+			if (DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES.isEnabled(internal::currentConfigs()))
+				throw ParseException();
+			return false;
+		}
+		if (m_recycling)
+		{
+			// findMember leaves the cursor just after the slot it returned
+			m_recycleSeen[(m_schema ? m_schema->fields().size() : 0) + m_parseCursor - 1] = 1;
+		}
+		stypeCommon->deserialize(type, payload, offset, docEndPos);
+		return true;
+	}
+
+	namespace internal {
+		void dummyRead(const unsigned char *payload, uint32_t *offset, uint32_t docEndPos, uint8_t type)
+		{
+			uint32_t avail;
+			uint32_t size;
+			if (*offset > docEndPos)
+				throw Serializable::ParseException();
+			avail = docEndPos - *offset;
+			if (!elementValueSize(type, payload + *offset, avail, &size) || (size > avail))
+				throw Serializable::ParseException();
+			*offset += size;
+		}
 	}
 
 	namespace internal {
-		void dummyRead(const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t docEndPos, uint8_t type)
+		/**
+		 * How the value of each element type is sized
+		 */
+		struct SkipTable {
+			enum Kind {
+				KIND_INVALID = 0,
+				KIND_FIXED,         // width bytes
+				KIND_STRING,        // int32 length of at least 1, then that many bytes, then width bytes
+				KIND_SIZED,         // int32 size of at least width, covering itself
+				KIND_BINARY,        // int32 length, then a subtype byte and that many bytes
+				KIND_CSTRINGS,      // width cstrings
+			};
+			uint8_t kinds[256];
+			uint8_t widths[256];
+
+			void set(uint8_t type, Kind kind, uint8_t width) {
+				kinds[type] = kind;
+				widths[type] = width;
+			}
+
+			SkipTable() {
+				memset(kinds, KIND_INVALID, sizeof(kinds));
+				memset(widths, 0, sizeof(widths));
+				set(BSONTYPE_DOUBLE, KIND_FIXED, 8);
+				set(BSONTYPE_STRING_UTF8, KIND_STRING, 0);
+				set(BSONTYPE_DOCUMENT, KIND_SIZED, 5);
+				set(BSONTYPE_ARRAY, KIND_SIZED, 5);
+				set(BSONTYPE_BINARY, KIND_BINARY, 0);
+				set(BSONTYPE_UNDEFINED, KIND_FIXED, 0);
+				set(BSONTYPE_OBJECTID, KIND_FIXED, 12);
+				set(BSONTYPE_BOOL, KIND_FIXED, 1);
+				set(BSONTYPE_UTCDATETIME, KIND_FIXED, 8);
+				set(BSONTYPE_NULL, KIND_FIXED, 0);
+				set(BSONTYPE_REGEX, KIND_CSTRINGS, 2);
+				set(BSONTYPE_DBPOINTER, KIND_STRING, 12);
+				set(BSONTYPE_JAVASCRIPT, KIND_STRING, 0);
+				set(BSONTYPE_SYMBOL, KIND_STRING, 0);
+				set(BSONTYPE_JAVASCRIPT_SCOPE, KIND_SIZED, 14);
+				set(BSONTYPE_INT32, KIND_FIXED, 4);
+				set(BSONTYPE_TIMESTAMP, KIND_FIXED, 8);
+				set(BSONTYPE_INT64, KIND_FIXED, 8);
+				set(BSONTYPE_DECIMAL128, KIND_FIXED, 16);
+				set(BSONTYPE_MAXKEY, KIND_FIXED, 0);
+				set(BSONTYPE_MINKEY, KIND_FIXED, 0);
+			}
+		};
+
+		static const SkipTable &skipTable()
+		{
+			static const SkipTable table;
+			return table;
+		}
+
+		SkipResult skipValueSize(uint8_t type, const unsigned char *value, uint32_t avail, uint32_t *pSize)
 		{
-			switch (type)
+			const SkipTable &table = skipTable();
+			uint32_t width = table.widths[type];
+			uint32_t length;
+			uint32_t pos;
+
+			switch (table.kinds[type])
 			{
-			case BsonTypes::BSONTYPE_DOUBLE:
-				*offset += 8;
-				break;
-			case BsonTypes::BSONTYPE_STRING_UTF8:
-				*offset += readValue<uint32_t>(payload, offset, docEndPos);
-				break;
-			case BsonTypes::BSONTYPE_DOCUMENT:
-				*offset += readValue<uint32_t>(payload, offset, docEndPos) - 4;
-				break;
-			case BsonTypes::BSONTYPE_ARRAY:
-				*offset += readValue<uint32_t>(payload, offset, docEndPos) - 4;
-				break;
-			case BsonTypes::BSONTYPE_BINARY:
-				*offset += 1 + readValue<uint32_t>(payload, offset, docEndPos);
-				break;
-			case BsonTypes::BSONTYPE_UTCDATETIME:
-				*offset += 8;
-				break;
-			case BsonTypes::BSONTYPE_BOOL:
-				*offset += 1;
-				break;
-			case BsonTypes::BSONTYPE_NULL:
+			case SkipTable::KIND_FIXED:
+				*pSize = width;
+				return SKIP_OK;
+			case SkipTable::KIND_CSTRINGS:
+				for (pos = 0; width > 0; width--)
+				{
+					const unsigned char *end = (pos < avail) ? (const unsigned char*)memchr(value + pos, 0, avail - pos) : NULL;
+					if (!end)
+					{
+						*pSize = avail + 1;
+						return SKIP_NEED_MORE;
+					}
+					pos = (uint32_t)(end - value) + 1;
+				}
+				*pSize = pos;
+				return SKIP_OK;
+			case SkipTable::KIND_INVALID:
+				return SKIP_UNKNOWN_TYPE;
+			default:
 				break;
-			case BsonTypes::BSONTYPE_INT32:
-				*offset += 4;
+			}
+
+			if (avail < 4)
+			{
+				*pSize = 4;
+				return SKIP_NEED_MORE;
+			}
+			memcpy(&length, value, sizeof(length));
+			switch (table.kinds[type])
+			{
+			case SkipTable::KIND_STRING:
+				if ((length == 0) || (length > (0xFFFFFFFFu - 4 - width)))
+					return SKIP_BAD_LENGTH;
+				*pSize = 4 + length + width;
 				break;
-			case BsonTypes::BSONTYPE_TIMESTAMP:
-				*offset += 8;
+			case SkipTable::KIND_SIZED:
+				if (length < width)
+					return SKIP_BAD_LENGTH;
+				*pSize = length;
 				break;
-			case BsonTypes::BSONTYPE_INT64:
-				*offset += 8;
+			default:
+				if (length > (0xFFFFFFFFu - 5))
+					return SKIP_BAD_LENGTH;
+				*pSize = 5 + length;
 				break;
+			}
+			return SKIP_OK;
+		}
+
+		bool elementValueSize(uint8_t type, const unsigned char *value, uint32_t avail, uint32_t *pSize)
+		{
+			switch (skipValueSize(type, value, avail, pSize))
+			{
+			case SKIP_OK:
+				return true;
+			case SKIP_NEED_MORE:
+				return false;
 			default:
 				throw Serializable::ParseException();
-				break;
 			}
 		}
+
+		static thread_local std::deque<std::vector<const void*> > visitedEntryLists;
+		static thread_local size_t visitedEntryDepth = 0;
+
+		VisitedEntries::VisitedEntries()
+			: m_entries((visitedEntryDepth < visitedEntryLists.size()) ? visitedEntryLists[visitedEntryDepth] : (visitedEntryLists.emplace_back(), visitedEntryLists.back()))
+		{
+			visitedEntryDepth++;
+			m_entries.clear();
+		}
+
+		VisitedEntries::~VisitedEntries()
+		{
+			visitedEntryDepth--;
+		}
+
+		size_t VisitedEntries::distinct()
+		{
+			std::sort(m_entries.begin(), m_entries.end(), std::less<const void*>());
+			m_entries.erase(std::unique(m_entries.begin(), m_entries.end()), m_entries.end());
+			return m_entries.size();
+		}
+
+		bool VisitedEntries::contains(const void *entry) const
+		{
+			return std::binary_search(m_entries.begin(), m_entries.end(), entry, std::less<const void*>());
+		}
+
+		uint32_t countElements(const unsigned char *payload, uint32_t offset, uint32_t documentSize)
+		{
+			uint32_t count = 0;
+			uint32_t docEndPos = readDocumentEnd(payload, &offset, documentSize);
+			for (;;)
+			{
+				uint8_t type = readElementType(payload, &offset, docEndPos);
+				if (type == 0)
+					break;
+				readElementName(payload, &offset, docEndPos);
+				dummyRead(payload, &offset, docEndPos, type);
+				count++;
+			}
+			return count;
+		}
 	}
 
-	uint32_t internal::BsonParser::parse(BsonParseHandler *handler)
+	void internal::dispatchElement(BsonParseHandler *handler, uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos, bool envelope)
 	{
-		docSize = readValue<uint32_t>(payload, offset, rootDocSize);
-		docEndPos = *offset + docSize - 4;
+		if (isMetadataName(name, METADATA_NAME_KEY, sizeof(METADATA_NAME_KEY) - 1))
+		{
+			std::string sname;
+			internal::ObjectHelper<0, std::string>::deserialize(NULL, sname, type, payload, offset, docEndPos);
+			handler->serializableNameHandle(METADATA_NAME_KEY, sname);
+		}else if (isMetadataName(name, METADATA_VERSION_KEY, sizeof(METADATA_VERSION_KEY) - 1))
+		{
+			int64_t sver = readValue<int64_t>(payload, offset, docEndPos);
+			handler->serializableSerialVersionUIDHandle(METADATA_VERSION_KEY, sver);
+		}else if (envelope && isMetadataName(name, METADATA_TYPEID_KEY, sizeof(METADATA_TYPEID_KEY) - 1))
+		{
+			// Reported through the same handlers as the legacy envelope
+			std::string sname;
+			int64_t sver;
+			if (type != BSONTYPE_INT32)
+				throw Serializable::ParseException();
+			if (!SerializableTypeIds::findType(readValue<int32_t>(payload, offset, docEndPos), &sname, &sver))
+				throw Serializable::ParseException();
+			handler->serializableNameHandle(METADATA_NAME_KEY, sname);
+			handler->serializableSerialVersionUIDHandle(METADATA_VERSION_KEY, sver);
+		}else if (!handler->bsonParseHandle(type, name, payload, offset, docEndPos))
+		{
+			internal::dummyRead(payload, offset, docEndPos, type);
+		}
+	}
 
-		while ((docEndPos - *offset) > 0)
+	namespace internal {
+		/**
+		 * Walks a document checking every size, name, string and terminator against its bounds
+		 */
+		class DocumentValidator
 		{
-			uint8_t type = payload[(*offset)++];
-			if (type == 0)
-				break;
-			std::string ename;
-			while(1)
-			{
-				char c;
-				if ((docEndPos - *offset) == 0)
-					throw Serializable::ParseException();
-				c = payload[(*offset)++];
-				if (!c)
+		private:
+			const unsigned char *m_payload;
+			DecodeStatus *m_status;
+			std::string m_path;
+			size_t m_target;
+			std::string *m_targetPath;
+
+			bool fail(DecodeStatus::ErrorKind kind, size_t offset) {
+				m_status->kind = kind;
+				m_status->offset = offset;
+				m_status->path = m_path;
+				return false;
+			}
+
+			/**
+			 * envelope is set for the first element of the root document, the only one checked as a compact envelope.
+			 * Nested Serializable documents cannot be told from maps here, their envelopes are checked when decoded.
+			 */
+			bool value(uint8_t type, const BsonStringView &name, size_t offset, size_t end, int depth, bool envelope, size_t *pSize) {
+				size_t avail = end - offset;
+				uint32_t size;
+				if ((type == BsonTypes::BSONTYPE_DOCUMENT) || (type == BsonTypes::BSONTYPE_ARRAY))
+					return document(offset, end, depth + 1, pSize);
+				switch (skipValueSize(type, m_payload + offset, (uint32_t)avail, &size))
+				{
+				case SKIP_OK:
 					break;
-				ename.push_back(c);
+				case SKIP_NEED_MORE:
+					return fail(DecodeStatus::DECODE_TRUNCATED, offset);
+				case SKIP_UNKNOWN_TYPE:
+					return fail(DecodeStatus::DECODE_UNKNOWN_TYPE, offset - name.length() - 2);
+				default:
+					return fail((type == BsonTypes::BSONTYPE_STRING_UTF8) ? DecodeStatus::DECODE_BAD_STRING : DecodeStatus::DECODE_BAD_SIZE, offset);
+				}
+				if (size > avail)
+					return fail(DecodeStatus::DECODE_TRUNCATED, offset);
+				if ((type == BsonTypes::BSONTYPE_STRING_UTF8) && (m_payload[offset + size - 1] != 0))
+					return fail(DecodeStatus::DECODE_BAD_STRING, offset + size - 1);
+				if (envelope && (type == BsonTypes::BSONTYPE_INT32) && isMetadataName(name, METADATA_TYPEID_KEY, sizeof(METADATA_TYPEID_KEY) - 1))
+				{
+					int32_t typeId;
+					memcpy(&typeId, m_payload + offset, sizeof(typeId));
+					if (!SerializableTypeIds::findType(typeId, NULL, NULL))
+						return fail(DecodeStatus::DECODE_UNKNOWN_TYPE_ID, offset);
+				}
+				*pSize = size;
+				return true;
 			}
-			if (ename == "@jsbsonrpcsname")
-			{
-				std::string sname;
-				internal::ObjectHelper<0, std::string>::deserialize(NULL, sname, type, payload, offset, docEndPos);
-				handler->serializableNameHandle(ename, sname);
-			}else if (ename == "@jsbsonrpcsver")
-			{
-				int64_t sver = readValue<int64_t>(payload, offset, docEndPos);
-				handler->serializableSerialVersionUIDHandle(ename, sver);
-			}else if (!handler->bsonParseHandle(type, ename, payload, offset, docEndPos))
+
+		public:
+			DocumentValidator(const unsigned char *payload, DecodeStatus *status, size_t target = 0, std::string *targetPath = NULL)
+				: m_payload(payload), m_status(status), m_target(target), m_targetPath(targetPath) {}
+
+			bool document(size_t offset, size_t end, int depth, size_t *pSize) {
+				uint32_t docSize;
+				size_t docEnd;
+				size_t pos;
+				bool envelope;
+				if (depth > DecodeStatus::MAX_DEPTH)
+					return fail(DecodeStatus::DECODE_TOO_DEEP, offset);
+				if ((end - offset) < 4)
+					return fail(DecodeStatus::DECODE_TRUNCATED, offset);
+				memcpy(&docSize, m_payload + offset, sizeof(docSize));
+				if ((docSize < 5) || (docSize > (end - offset)))
+					return fail(DecodeStatus::DECODE_BAD_SIZE, offset);
+				docEnd = offset + docSize - 1;
+				pos = offset + 4;
+				envelope = (depth == 0);
+				while (pos < docEnd)
+				{
+					uint8_t type = m_payload[pos];
+					size_t elementStart = pos;
+					const unsigned char *nameEnd;
+					size_t pathLength = m_path.length();
+					size_t valueSize;
+					if (type == 0)
+						return fail(DecodeStatus::DECODE_BAD_TERMINATOR, pos);
+					nameEnd = (const unsigned char*)memchr(m_payload + pos + 1, 0, docEnd - pos - 1);
+					if (!nameEnd)
+						return fail(DecodeStatus::DECODE_TRUNCATED, pos + 1);
+					BsonStringView name((const char*)m_payload + pos + 1, nameEnd - (m_payload + pos + 1));
+					if (pathLength)
+						m_path.push_back('.');
+					m_path.append(name.data(), name.length());
+					if (m_targetPath && (elementStart == m_target))
+						*m_targetPath = m_path;
+					pos = (nameEnd - m_payload) + 1;
+					if (!value(type, name, pos, docEnd, depth, envelope, &valueSize))
+						return false;
+					envelope = false;
+					pos += valueSize;
+					m_path.resize(pathLength);
+				}
+				if (m_payload[docEnd] != 0)
+					return fail(DecodeStatus::DECODE_BAD_TERMINATOR, docEnd);
+				*pSize = docSize;
+				return true;
+			}
+		};
+
+		bool validateDocument(const unsigned char *payload, size_t len, size_t offset, DecodeStatus *status)
+		{
+			DocumentValidator validator(payload, status);
+			size_t docSize;
+			if (offset > len)
 			{
-				internal::dummyRead(payload, offset, docEndPos, type);
+				status->kind = DecodeStatus::DECODE_TRUNCATED;
+				status->offset = len;
+				return false;
 			}
+			return validator.document(offset, len, 0, &docSize);
+		}
+
+		std::string elementPathAt(const unsigned char *payload, size_t len, size_t offset, size_t target)
+		{
+			DecodeStatus status;
+			std::string path;
+			DocumentValidator validator(payload, &status, target, &path);
+			size_t docSize;
+			validator.document(offset, len, 0, &docSize);
+			return path;
+		}
+	}
+
+	uint32_t internal::BsonParser::parse(BsonParseHandler *handler)
+	{
+		bool first = envelope;
+		docEndPos = readDocumentEnd(payload, offset, rootDocSize);
+		docSize = docEndPos - (*offset - 4);
+
+		for (;;)
+		{
+			if (context)
+				context->elementOffset = *offset;
+			uint8_t type = readElementType(payload, offset, docEndPos);
+			if (type == 0)
+				break;
+			BsonStringView ename = readElementName(payload, offset, docEndPos);
+			dispatchElement(handler, type, ename, payload, offset, docEndPos, first);
+			first = false;
 		}
-		if((docEndPos - *offset) != 0)
-			throw Serializable::ParseException();
 		return docSize;
 	}
 
-	bool Serializable::readMetadata(const std::vector<unsigned char>& payload, size_t offset, std::string *pName, int64_t *pSerialVersionUID, uint32_t *pDocSize)
+	bool Serializable::readMetadata(const uint8_t *payload, size_t len, size_t offset, std::string *pName, int64_t *pSerialVersionUID, uint32_t *pDocSize)
 	{
 		uint32_t docSize;
-		uint32_t rootDocSize;
 		uint32_t parseOffset = offset;
 		uint32_t docEndPos;
-		std::string ename;
 
 		std::string sname;
 		int64_t sver = 0;
 
 		int readFlag = 0;
+		bool first = true;
 
-		docSize = internal::readValue<uint32_t>(payload, &parseOffset, payload.size());
-		docEndPos = parseOffset + docSize - 4;
+		if (len > 0xFFFFFFFFu)
+			throw Serializable::ParseException();
+		docEndPos = internal::readDocumentEnd(payload, &parseOffset, (uint32_t)len);
+		docSize = docEndPos - (parseOffset - 4);
 
-		while ((docEndPos - parseOffset) > 0)
+		// serialize() writes the name and the version first, so the scan normally stops after two elements.
+		// A document from another producer may carry them anywhere and is scanned until both are found.
+		while (readFlag != 3)
 		{
-			uint8_t type = payload[(parseOffset)++];
+			uint8_t type = internal::readElementType(payload, &parseOffset, docEndPos);
 			if (type == 0)
 				break;
-			ename.clear();
-			while (1)
-			{
-				char c;
-				if ((docEndPos - parseOffset) == 0)
-					throw Serializable::ParseException();
-				c = payload[(parseOffset)++];
-				if (!c)
-					break;
-				ename.push_back(c);
-			}
-			if (ename == "@jsbsonrpcsname")
+			BsonStringView ename = internal::readElementName(payload, &parseOffset, docEndPos);
+			if (internal::isMetadataName(ename, internal::METADATA_NAME_KEY, sizeof(internal::METADATA_NAME_KEY) - 1))
 			{
-				internal::ObjectHelper<0, std::string>::deserialize(NULL, sname, type, payload, &parseOffset, docEndPos);
-				if (pName)
-					*pName = sname;
+				internal::ObjectHelper<0, std::string>::deserialize(NULL, pName ? *pName : sname, type, payload, &parseOffset, docEndPos);
 				readFlag |= 1;
 			}
-			else if (ename == "@jsbsonrpcsver")
+			else if (internal::isMetadataName(ename, internal::METADATA_VERSION_KEY, sizeof(internal::METADATA_VERSION_KEY) - 1))
 			{
 				sver = internal::readValue<int64_t>(payload, &parseOffset, docEndPos);
 				if (pSerialVersionUID)
 					*pSerialVersionUID = sver;
 				readFlag |= 2;
+			}
+			else if (first && internal::isMetadataName(ename, internal::METADATA_TYPEID_KEY, sizeof(internal::METADATA_TYPEID_KEY) - 1) && (type == internal::BSONTYPE_INT32))
+			{
+				if (SerializableTypeIds::findType(internal::readValue<int32_t>(payload, &parseOffset, docEndPos), pName, pSerialVersionUID))
+					readFlag = 3;
 			}else{
 				internal::dummyRead(payload, &parseOffset, docEndPos, type);
 			}
+			first = false;
 		}
-		if ((docEndPos - parseOffset) != 0)
-			throw Serializable::ParseException();
-
 		if (pDocSize)
 			*pDocSize = docSize;
 
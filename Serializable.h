@@ -26,44 +26,188 @@
 
 #include <stdint.h>
 #include <wchar.h>
+#include <string.h>
 #include <string>
 #include <list>
 #include <map>
 #include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
 #include <exception>
+#include <type_traits>
+#include <initializer_list>
+#include <bitset>
 
 #include <assert.h>
 
+#include "BsonSink.h"
+#include "BsonArena.h"
+
 #if defined(HAS_JSCPPUTILS) && HAS_JSCPPUTILS
 #include <JsCPPUtils/SmartPointer.h>
 #include <JsCPPUtils/Base64.h>
 #endif
 
+#ifndef JSBSONRPC_MAX_DESERIALIZATION_CONFIGS
+#define JSBSONRPC_MAX_DESERIALIZATION_CONFIGS 64
+#endif
+
 namespace JsBsonRPC {
 
 	class DeserializationConfig {
 	public:
-		struct BuildContext {
-			int ordinal;
-			std::list<DeserializationConfig> list;
+		static_assert(JSBSONRPC_MAX_DESERIALIZATION_CONFIGS <= 64, "getMask() holds the bits of at most 64 flags");
+
+		/**
+		 * Thrown when a flag is given an ordinal outside the Mask, or when every runtime ordinal is taken
+		 */
+		class OrdinalOutOfRangeException : public std::exception
+		{ };
+
+		/**
+		 * Per flag, whether it differs from its default value. The empty mask therefore has every flag at its default.
+		 */
+		typedef std::bitset<JSBSONRPC_MAX_DESERIALIZATION_CONFIGS> Mask;
+
+		/**
+		 * Ordinals of the built-in flags. Flags declared at compile time take ordinals from FIRST_USER_ORDINAL
+		 * up to FIRST_RUNTIME_ORDINAL, flags registered at run time are numbered from FIRST_RUNTIME_ORDINAL.
+		 */
+		enum {
+			ORDINAL_FAIL_ON_UNKNOWN_PROPERTIES = 0,
+			ORDINAL_RECYCLE_OBJECTS = 1,
+			FIRST_USER_ORDINAL = 8,
+			FIRST_RUNTIME_ORDINAL = 32,
 		};
+
 	private:
 		bool defaultValue;
-		uint32_t mask;
-
-		static BuildContext *getBuildContext();
+		int ordinal;
 
 	public:
-		DeserializationConfig(bool defaultValue);
-		uint32_t getMask() const { return mask; }
+		/**
+		 * Flag with a fixed ordinal. It is constant initialized, so it can be used from any static initializer,
+		 * and an ordinal outside the Mask fails to compile there. Elsewhere it throws OrdinalOutOfRangeException.
+		 */
+		constexpr DeserializationConfig(int ordinal, bool defaultValue)
+			: defaultValue(defaultValue),
+			  ordinal(((ordinal >= 0) && (ordinal < JSBSONRPC_MAX_DESERIALIZATION_CONFIGS)) ? ordinal : throw OrdinalOutOfRangeException()) {}
+		/**
+		 * Registers a new flag under the next free ordinal from FIRST_RUNTIME_ORDINAL. Registration is thread-safe.
+		 * Throws OrdinalOutOfRangeException once all JSBSONRPC_MAX_DESERIALIZATION_CONFIGS ordinals are taken.
+		 */
+		DeserializationConfig(bool defaultValue) throw(OrdinalOutOfRangeException);
+		/**
+		 * Bit of the flag in a Mask, as an integer
+		 */
+		uint64_t getMask() const { return (uint64_t)1 << ordinal; }
+		int getOrdinal() const { return ordinal; }
 		bool getDefaultValue() const { return defaultValue; }
+		bool isEnabled(const Mask &configs) const { return configs[ordinal] != defaultValue; }
+		void configure(Mask &configs, bool enable) const { configs[ordinal] = (enable != defaultValue); }
 		
 	public:
-		static uint32_t getDefaultConfigure();
-		static DeserializationConfig FAIL_ON_UNKNOWN_PROPERTIES;
+		/**
+		 * Every flag at its default value, which is the empty mask
+		 */
+		static const Mask &getDefaultConfigure();
+		/**
+		 * Throw ParseException on an element no member is mapped to, instead of skipping it.
+		 * Set on the root object, it applies to the whole decoded graph. Off by default.
+		 */
+		static const DeserializationConfig FAIL_ON_UNKNOWN_PROPERTIES;
+		/**
+		 * Decode into the storage the object already holds: list and vector elements, map entries,
+		 * nested objects and string capacity are overwritten in place and only the excess is removed.
+		 * Members missing from the document are cleared, as if the object had been freshly constructed.
+		 * Set on the root object, it applies to the whole decoded graph. Off by default.
+		 */
+		static const DeserializationConfig RECYCLE_OBJECTS;
 	};
 
 	class Serializable;
+	class BsonProjection;
+	class BsonStreamParser;
+
+	/**
+	 * Non-owning view of a character range, usually pointing into a BSON payload.
+	 * Valid only while the underlying buffer is alive and unmodified.
+	 */
+	class BsonStringView
+	{
+	private:
+		const char *m_data;
+		size_t m_length;
+
+	public:
+		BsonStringView() : m_data(""), m_length(0) {}
+		BsonStringView(const char *data, size_t length) : m_data(data), m_length(length) {}
+		BsonStringView(const char *str) : m_data(str), m_length(strlen(str)) {}
+		template<typename Traits, typename Alloc>
+		BsonStringView(const std::basic_string<char, Traits, Alloc> &str) : m_data(str.data()), m_length(str.length()) {}
+
+		const char *data() const { return m_data; }
+		size_t length() const { return m_length; }
+		size_t size() const { return m_length; }
+		bool empty() const { return m_length == 0; }
+
+		std::string str() const {
+			return std::string(m_data, m_length);
+		}
+
+		bool equals(const char *str, size_t len) const {
+			return (m_length == len) && (memcmp(m_data, str, len) == 0);
+		}
+
+		bool operator==(const BsonStringView &other) const {
+			return equals(other.m_data, other.m_length);
+		}
+		bool operator!=(const BsonStringView &other) const {
+			return !equals(other.m_data, other.m_length);
+		}
+		bool operator<(const BsonStringView &other) const {
+			int result = memcmp(m_data, other.m_data, (m_length < other.m_length) ? m_length : other.m_length);
+			return (result < 0) || ((result == 0) && (m_length < other.m_length));
+		}
+	};
+
+	/**
+	 * Non-owning view of a BSON binary value.
+	 * Valid only while the underlying buffer is alive and unmodified.
+	 */
+	class BsonBinaryView
+	{
+	private:
+		const unsigned char *m_data;
+		size_t m_length;
+		uint8_t m_subtype;
+
+	public:
+		BsonBinaryView() : m_data(NULL), m_length(0), m_subtype(0) {}
+		BsonBinaryView(const void *data, size_t length, uint8_t subtype = 0) : m_data((const unsigned char*)data), m_length(length), m_subtype(subtype) {}
+
+		const unsigned char *data() const { return m_data; }
+		size_t length() const { return m_length; }
+		size_t size() const { return m_length; }
+		bool empty() const { return m_length == 0; }
+		uint8_t subtype() const { return m_subtype; }
+
+		std::vector<unsigned char> copy() const {
+			return std::vector<unsigned char>(m_data, m_data + m_length);
+		}
+	};
+
+	/**
+	 * std::unordered_map that is serialized with its keys in sorted order, for deterministic output.
+	 * A plain std::unordered_map member is emitted in bucket order.
+	 */
+	template<typename T>
+	class SortedKeysUnorderedMap : public std::unordered_map<std::string, T>
+	{
+	public:
+		using std::unordered_map<std::string, T>::unordered_map;
+	};
 
 	class SerializableCreateFactory
 	{
@@ -82,7 +226,62 @@ namespace JsBsonRPC {
 #endif
 
 	namespace internal {
-		extern uint32_t serializeNullObject(std::vector<unsigned char> &payload, const std::string& key);
+		class MemberLookupTable;
+
+		enum BsonTypes {
+			BSONTYPE_DOUBLE = 0x01,
+			BSONTYPE_STRING_UTF8 = 0x02,
+			BSONTYPE_DOCUMENT = 0x03,
+			BSONTYPE_ARRAY = 0x04,
+			BSONTYPE_BINARY = 0x05,
+			BSONTYPE_UNDEFINED = 0x06,
+			BSONTYPE_OBJECTID = 0x07,
+			BSONTYPE_BOOL = 0x08,
+			BSONTYPE_UTCDATETIME = 0x09,
+			BSONTYPE_NULL = 0x0A,
+			BSONTYPE_REGEX = 0x0B,
+			BSONTYPE_DBPOINTER = 0x0C,
+			BSONTYPE_JAVASCRIPT = 0x0D,
+			BSONTYPE_SYMBOL = 0x0E,
+			BSONTYPE_JAVASCRIPT_SCOPE = 0x0F,
+			BSONTYPE_INT32 = 0x10,
+			BSONTYPE_TIMESTAMP = 0x11,
+			BSONTYPE_INT64 = 0x12,
+			BSONTYPE_DECIMAL128 = 0x13,
+			BSONTYPE_MAXKEY = 0x7F,
+			BSONTYPE_MINKEY = 0xFF,
+		};
+
+		// Defined below, once every member type they refer to is complete
+		template<typename D>
+		class IsSerializableClass;
+		template<typename D>
+		class IsSerializableSmartpointerClass;
+		template<int PreType, typename T>
+		struct ObjectHelper;
+
+		extern uint32_t serializeNullObject(BsonSink &payload, const BsonStringView &key);
+
+		inline void writeBytes(BsonSink &payload, const void *data, size_t len) {
+			payload.write(data, len);
+		}
+
+		template <typename T>
+		inline void writeValue(BsonSink &payload, const T &value) {
+			payload.write(&value, sizeof(value));
+		}
+
+		template <typename T>
+		inline void patchValue(BsonSink &payload, size_t pos, const T &value) {
+			payload.patch(pos, &value, sizeof(value));
+		}
+
+		/**
+		 * Size of element header : type(1) + key + NUL(1)
+		 */
+		inline uint32_t elementHeaderSize(size_t keyLength) {
+			return (uint32_t)(2 + keyLength);
+		}
 
 		class STypeCommon
 		{
@@ -91,11 +290,30 @@ namespace JsBsonRPC {
 			SerializableCreateFactory *createFactory;
 			SerializableSmartpointerCreateFactory *createSmartpointerFactory;
 			bool _isnull;
+			/**
+			 * Set by every change of the value, cleared when the owner caches the encoded element
+			 */
+			mutable bool _dirty;
 
 		public:
 			STypeCommon() {
 				this->createFactory = NULL;
 				this->createSmartpointerFactory = NULL;
+				this->_isnull = false;
+				this->_dirty = true;
+			}
+			/**
+			 * A copied or moved member has no encoded element cached by its new owner, so it starts dirty
+			 */
+			STypeCommon(const STypeCommon &other)
+				: key(other.key), createFactory(other.createFactory), createSmartpointerFactory(other.createSmartpointerFactory), _isnull(other._isnull), _dirty(true) {}
+			STypeCommon &operator=(const STypeCommon &other) {
+				this->key = other.key;
+				this->createFactory = other.createFactory;
+				this->createSmartpointerFactory = other.createSmartpointerFactory;
+				this->_isnull = other._isnull;
+				this->_dirty = true;
+				return *this;
 			}
 			virtual ~STypeCommon() {}
 
@@ -122,12 +340,30 @@ namespace JsBsonRPC {
 					key = name;
 			}
 
-			std::string getMemberName() const {
+			const std::string &getMemberName() const {
 				return key;
 			}
 
 			void setNull() {
 				_isnull = true;
+				_dirty = true;
+			}
+
+			void markDirty() {
+				_dirty = true;
+			}
+			void markClean() const {
+				_dirty = false;
+			}
+			bool isDirty() const {
+				return _dirty;
+			}
+
+			/**
+			 * Whether the encoded element may be cached, false when the value can change without going through this SType
+			 */
+			virtual bool isFragmentCacheable() const {
+				return true;
 			}
 
 			bool isNull() const {
@@ -135,16 +371,91 @@ namespace JsBsonRPC {
 			}
 
 			virtual void clear() = 0;
-			virtual uint32_t serialize(std::vector<unsigned char> &payload) const = 0;
-			virtual uint32_t deserialize(uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) = 0;
+			virtual uint32_t serializedSize() const = 0;
+			virtual uint32_t serialize(BsonSink &payload) const = 0;
+			virtual uint32_t deserialize(uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) = 0;
 		};
 
 		class BsonParseHandler {
 		public:
 			virtual void serializableNameHandle(const std::string& attrName, const std::string& value) {}
 			virtual void serializableSerialVersionUIDHandle(const std::string& attrName, int64_t value) {}
-			virtual bool bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) = 0;
+			/**
+			 * Called by BsonParser for every element. name points into the payload.
+			 * The default implementation copies the name and forwards to the std::string overload.
+			 */
+			virtual bool bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) {
+				return bsonParseHandle(type, name.str(), payload, offset, docEndPos);
+			}
+			/**
+			 * Legacy overload, kept for handlers that want an owned name
+			 */
+			virtual bool bsonParseHandle(uint8_t type, const std::string &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) {
+				return false;
+			}
+		};
+
+		/**
+		 * State shared by every parser taking part in one root deserialization on this thread
+		 */
+		struct DecodeContext {
+			DeserializationConfig::Mask configs;
+			bool recycle;
+			/**
+			 * Start of the element dispatched last, which is the innermost one being decoded when decoding fails
+			 */
+			uint32_t elementOffset;
+			/**
+			 * Members selected for the object being decoded, NULL for all of them
+			 */
+			const BsonProjection *projection;
+			/**
+			 * Arena the decoded arena member types allocate from, NULL for the heap
+			 */
+			BsonArena *arena;
 		};
+
+		extern DecodeContext *currentDecodeContext();
+
+		/**
+		 * Installs a DecodeContext for the root deserialization, nested ones keep the root's
+		 */
+		class DecodeScope
+		{
+		private:
+			DecodeContext m_context;
+			DecodeContext *m_previous;
+			bool m_installed;
+
+		public:
+			DecodeScope(const DeserializationConfig::Mask &configs);
+			~DecodeScope();
+
+			/**
+			 * True for the scope of the root deserialization
+			 */
+			bool installed() const {
+				return m_installed;
+			}
+		};
+
+		inline bool isRecycling() {
+			DecodeContext *context = currentDecodeContext();
+			return context && context->recycle;
+		}
+
+		inline BsonArena *currentArena() {
+			DecodeContext *context = currentDecodeContext();
+			return context ? context->arena : NULL;
+		}
+
+		/**
+		 * Configs of the root object being deserialized on this thread, which nested containers decode with
+		 */
+		inline const DeserializationConfig::Mask &currentConfigs() {
+			DecodeContext *context = currentDecodeContext();
+			return context ? context->configs : DeserializationConfig::getDefaultConfigure();
+		}
 	}
 
 	template<typename T>
@@ -154,14 +465,34 @@ namespace JsBsonRPC {
 		T object;
 
 	public:
-		uint32_t serialize(std::vector<unsigned char> &payload) const override
+		uint32_t serializedSize() const override
+		{
+			return serializedSizeAs(this->key.length());
+		}
+
+		uint32_t serialize(BsonSink &payload) const override
+		{
+			return serializeAs(payload, this->key);
+		}
+
+		/**
+		 * Non-virtual forms taking the key from the caller, used by SerializableSchema
+		 */
+		uint32_t serializedSizeAs(size_t keyLength) const
+		{
+			if (this->isNull())
+				return internal::elementHeaderSize(keyLength);
+			return internal::ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serializedSize(keyLength, this->object);
+		}
+
+		uint32_t serializeAs(BsonSink &payload, const std::string &key) const
 		{
 			if (this->isNull())
-				return internal::serializeNullObject(payload, this->key);
-			return internal::ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, this->key, this->object);
+				return internal::serializeNullObject(payload, key);
+			return internal::ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, key, this->object);
 		}
 
-		uint32_t deserialize(uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) override
+		uint32_t deserialize(uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) override
 		{
 			if (type == internal::BSONTYPE_NULL) {
 				clear();
@@ -169,15 +500,22 @@ namespace JsBsonRPC {
 				return 0;
 			}
 			this->_isnull = false;
+			this->_dirty = true;
 			return internal::ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(this, object, type, payload, offset, documentSize);
 		}
 
 		void clear() override {
+			this->_dirty = true;
 			internal::ObjectHelper<internal::IsSerializableClass<T>::Result, T>::objectClear(this->object);
 		}
 
+		bool isFragmentCacheable() const override {
+			return !internal::IsSerializableSmartpointerClass<T>::Result;
+		}
+
 		SType<T> &operator=(const T& value) {
 			this->_isnull = false;
+			this->_dirty = true;
 			this->object = value;
 			return *this;
 		}
@@ -186,17 +524,252 @@ namespace JsBsonRPC {
 			return this->object;
 		}
 
+		/**
+		 * Marks the member as changed. With the fragment cache enabled, do not keep the reference across serialize calls.
+		 */
 		T& ref() {
 			this->_isnull = false;
+			this->_dirty = true;
 			return this->object;
 		}
 
 		void set(const T& value) {
 			this->_isnull = false;
+			this->_dirty = true;
 			this->object = value;
 		}
 	};
 
+	namespace internal {
+		/**
+		 * Entry of a static per-class member table, see JSBSONRPC_SCHEMA
+		 */
+		struct SchemaField {
+			std::string name;
+			uint32_t (*serializedSize)(const Serializable *object, const std::string &name);
+			uint32_t (*serialize)(const Serializable *object, BsonSink &payload, const std::string &name);
+			uint32_t (*deserialize)(Serializable *object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize);
+			void (*clear)(Serializable *object);
+			const STypeCommon *(*member)(const Serializable *object);
+		};
+
+		/**
+		 * Encoders of one member bound at compile time through a pointer to member.
+		 * The SType calls are qualified so they are not dispatched virtually.
+		 */
+		template<typename C, typename S, S C::*Member>
+		struct SchemaFieldFunctions {
+			static uint32_t serializedSize(const Serializable *object, const std::string &name) {
+				return (static_cast<const C*>(object)->*Member).serializedSizeAs(name.length());
+			}
+			static uint32_t serialize(const Serializable *object, BsonSink &payload, const std::string &name) {
+				return (static_cast<const C*>(object)->*Member).serializeAs(payload, name);
+			}
+			static uint32_t deserialize(Serializable *object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				return (static_cast<C*>(object)->*Member).S::deserialize(type, payload, offset, documentSize);
+			}
+			static void clear(Serializable *object) {
+				(static_cast<C*>(object)->*Member).S::clear();
+			}
+			static const STypeCommon *member(const Serializable *object) {
+				return &(static_cast<const C*>(object)->*Member);
+			}
+			static SchemaField make(const char *name) {
+				SchemaField field;
+				field.name = name;
+				field.serializedSize = &serializedSize;
+				field.serialize = &serialize;
+				field.deserialize = &deserialize;
+				field.clear = &clear;
+				field.member = &member;
+				return field;
+			}
+		};
+	}
+
+	/**
+	 * Member table shared by every instance of a class.
+	 * Built once, on first use, by the JSBSONRPC_SCHEMA macro instead of per instance serializableMapMember calls.
+	 */
+	class SerializableSchema
+	{
+	private:
+		std::string m_name;
+		int64_t m_serialVersionUID;
+		std::vector<internal::SchemaField> m_fields;
+		internal::MemberLookupTable *m_lookupTable;
+
+		SerializableSchema(const SerializableSchema &obj);
+		SerializableSchema &operator=(const SerializableSchema &obj);
+
+	public:
+		SerializableSchema(const char *name, int64_t serialVersionUID, std::initializer_list<internal::SchemaField> fields);
+		~SerializableSchema();
+
+		const std::string &name() const { return m_name; }
+		int64_t serialVersionUID() const { return m_serialVersionUID; }
+		const std::vector<internal::SchemaField> &fields() const { return m_fields; }
+
+		/**
+		 * Index of the field, or -1
+		 */
+		int findField(const BsonStringView &name) const;
+	};
+
+/**
+ * Declares the static member table of a Serializable class, used as
+ *
+ *   class Foo : public JsBsonRPC::Serializable {
+ *   public:
+ *       JsBsonRPC::SType<int32_t> a;
+ *       JsBsonRPC::SType<std::string> b;
+ *       JSBSONRPC_SCHEMA(Foo, "foo", 1, JSBSONRPC_FIELD(Foo, a), JSBSONRPC_FIELD(Foo, b))
+ *       Foo() : Serializable(serializableSchema()) {}
+ *   };
+ */
+#define JSBSONRPC_SCHEMA(CLASS, NAME, VERSION, ...) \
+	static const JsBsonRPC::SerializableSchema &serializableSchema() { \
+		static const JsBsonRPC::SerializableSchema schema(NAME, VERSION, { __VA_ARGS__ }); \
+		return schema; \
+	}
+
+#define JSBSONRPC_FIELD(CLASS, MEMBER) \
+	JsBsonRPC::internal::SchemaFieldFunctions<CLASS, decltype(CLASS::MEMBER), &CLASS::MEMBER>::make(#MEMBER)
+
+	/**
+	 * Numeric type ids for the compact envelope.
+	 * A document of a registered class can carry its name and serial version as one int32 element "@t"
+	 * instead of the "@jsbsonrpcsname" and "@jsbsonrpcsver" elements.
+	 * "@t" is recognised only as the first element of a Serializable document, so maps may use it as a key.
+	 * Decoding accepts both envelopes whether or not the compact envelope is enabled, so peers only need
+	 * the ids registered before a sender enables it.
+	 */
+	class SerializableTypeIds
+	{
+	public:
+		/**
+		 * Ids must be unique. Registering an id again replaces its entry.
+		 */
+		static void registerType(int32_t typeId, const std::string &name, int64_t serialVersionUID);
+
+		/**
+		 * Makes serialize() write the compact envelope for registered classes. Off by default.
+		 */
+		static void setCompactEnvelope(bool enable);
+		static bool isCompactEnvelope();
+
+		static bool findTypeId(const std::string &name, int64_t serialVersionUID, int32_t *pTypeId);
+		static bool findType(int32_t typeId, std::string *pName, int64_t *pSerialVersionUID);
+
+		/**
+		 * Changes whenever a registration or the envelope mode changes, to invalidate cached ids
+		 */
+		static uint32_t generation();
+	};
+
+	/**
+	 * Constructors of Serializable classes by (name, serialVersionUID), used by Serializable::decodeAny()
+	 * and by SmartPointer members that have no create factory set.
+	 * Lookups do not lock, registration is meant to happen at startup, e.g. through a static Registrar.
+	 */
+	class SerializableRegistry
+	{
+	public:
+		typedef Serializable *(*CreateFunction)();
+
+		template<typename T>
+		class Registrar
+		{
+		public:
+			Registrar(const std::string &name, int64_t serialVersionUID) {
+				registerClass<T>(name, serialVersionUID);
+			}
+		};
+
+		static void registerType(const std::string &name, int64_t serialVersionUID, CreateFunction create);
+
+		template<typename T>
+		static void registerClass(const std::string &name, int64_t serialVersionUID) {
+			registerType(name, serialVersionUID, &createInstance<T>);
+		}
+
+		/**
+		 * New instance of the registered class, NULL if there is none
+		 */
+		static Serializable *create(const BsonStringView &name, int64_t serialVersionUID);
+		static bool isRegistered(const BsonStringView &name, int64_t serialVersionUID);
+
+	private:
+		template<typename T>
+		static Serializable *createInstance() {
+			return new T();
+		}
+	};
+
+	/**
+	 * Set of member paths for projected decoding, such as "id" or "header.traceId".
+	 * A path selects the member and everything below it, every other element is skipped whole.
+	 * Lists and maps do not take a path segment of their own, so "items.id" selects id in every element of items.
+	 */
+	class BsonProjection
+	{
+	private:
+		bool m_all;
+		std::vector<std::string> m_names;
+		std::vector<BsonProjection> m_children;
+
+	public:
+		BsonProjection() : m_all(false) {}
+		BsonProjection(std::initializer_list<std::string> paths);
+
+		BsonProjection &add(const std::string &path);
+
+		/**
+		 * Selection below the element name, NULL if the element is not selected
+		 */
+		const BsonProjection *find(const BsonStringView &name) const;
+
+		/**
+		 * True when everything below this point is selected
+		 */
+		bool includesAll() const {
+			return m_all;
+		}
+	};
+
+	/**
+	 * Result of Serializable::tryDeserialize.
+	 * On failure offset is the position in the input of the offending byte, or of the element whose value was rejected,
+	 * and path is the dotted names of the elements leading there, array elements being named by their index.
+	 */
+	struct DecodeStatus {
+		enum ErrorKind {
+			DECODE_OK = 0,
+			DECODE_TRUNCATED,        // a name or value runs past the end of its document
+			DECODE_BAD_SIZE,         // a document size below 5 or beyond the enclosing one
+			DECODE_BAD_TERMINATOR,   // a document that does not end where its size says
+			DECODE_BAD_STRING,       // a string length of 0 or a string not ending with a NUL
+			DECODE_UNKNOWN_TYPE,     // an element type that cannot be skipped
+			DECODE_UNKNOWN_TYPE_ID,  // a compact envelope id that is not registered
+			DECODE_TOO_DEEP,         // documents nested deeper than MAX_DEPTH
+			DECODE_REJECTED,         // a well-formed element the member could not be decoded from
+			DECODE_OUT_OF_MEMORY,    // an allocation failed while decoding
+		};
+		enum { MAX_DEPTH = 128 };
+
+		ErrorKind kind;
+		size_t offset;
+		std::string path;
+
+		DecodeStatus() : kind(DECODE_OK), offset(0) {}
+
+		bool ok() const {
+			return kind == DECODE_OK;
+		}
+
+		static const char *kindName(ErrorKind kind);
+	};
+
 	class Serializable : protected internal::BsonParseHandler
 	{
 	public:
@@ -210,17 +783,65 @@ namespace JsBsonRPC {
 		std::string m_name;
 		int64_t m_serialVersionUID;
 		std::list<internal::STypeCommon*> m_members;
-
-		uint32_t m_deserializationConfigs;
+		std::vector<internal::STypeCommon*> m_memberSlots;
+
+		/**
+		 * Name to slot table shared by all instances of the concrete class, resolved on first parse
+		 */
+		const internal::MemberLookupTable *m_memberLookupTable;
+		/**
+		 * Slot expected to come next while parsing, producers usually emit members in declaration order
+		 */
+		size_t m_parseCursor;
+
+		/**
+		 * Static member table of classes declared with JSBSONRPC_SCHEMA, NULL otherwise
+		 */
+		const SerializableSchema *m_schema;
+		size_t m_schemaCursor;
+
+		DeserializationConfig::Mask m_deserializationConfigs;
+
+		/**
+		 * Compact envelope type id, -1 for the legacy envelope. Valid while m_envelopeGeneration is current.
+		 */
+		mutable int32_t m_envelopeTypeId;
+		mutable uint32_t m_envelopeGeneration;
+
+		/**
+		 * RECYCLE_OBJECTS decoding : which schema fields and members (in this order) the document contained
+		 */
+		bool m_recycling;
+		std::vector<uint8_t> m_recycleSeen;
+
+		/**
+		 * Projected decoding : members selected for the current deserialization, NULL for all
+		 */
+		const BsonProjection *m_projection;
+
+		/**
+		 * Encoded elements of the schema fields and members (in this order) that have not changed since,
+		 * valid for the envelope generation in m_fragmentGeneration. Empty unless the fragment cache is enabled.
+		 */
+		bool m_fragmentCache;
+		mutable std::vector<std::vector<unsigned char> > m_fragments;
+		mutable uint32_t m_fragmentGeneration;
 
 	protected:
 #if (__cplusplus >= 201103) || (__cplusplus == 199711) || (defined(HAS_MOVE_SEMANTICS) && HAS_MOVE_SEMANTICS == 1)
-		explicit Serializable(Serializable&& _ref)
-		{
-			assert(false);
+		/**
+		 * Registered members are rebound to the same offsets inside this object,
+		 * so members passed to serializableMapMember must be subobjects of the derived object.
+		 * The derived class moves the SType members themselves.
+		 */
+		explicit Serializable(Serializable&& _ref);
+		Serializable& operator=(Serializable&& obj) {
+			assert(this->serializableNameRef() == obj.serializableNameRef());
+			this->m_deserializationConfigs = obj.m_deserializationConfigs;
+			return *this;
 		}
 #endif
-		bool bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) override;
+		bool bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) override;
 
 	private:
 		Serializable(const Serializable &obj) {
@@ -229,10 +850,11 @@ namespace JsBsonRPC {
 
 	public:
 		Serializable(const char *name, int64_t serialVersionUID);
+		Serializable(const SerializableSchema &schema);
 		virtual ~Serializable();
 
 		Serializable& operator=(const Serializable& obj) {
-			assert(this->m_name == obj.m_name);
+			assert(this->serializableNameRef() == obj.serializableNameRef());
 			assert(this->m_serialVersionUID == obj.m_serialVersionUID);
 			std::vector<uint8_t> payload;
 			this->m_deserializationConfigs = obj.m_deserializationConfigs;
@@ -243,13 +865,70 @@ namespace JsBsonRPC {
 
 		const std::list<internal::STypeCommon*> &serializableMembers() const { return m_members; }
 
-		size_t serialize(std::vector<unsigned char>& payload) const throw(UnavailableTypeException);
-		size_t deserialize(const std::vector<unsigned char>& payload, size_t offset = 0) throw (ParseException);
+		/**
+		 * Exact encoded size of this document in bytes
+		 */
+		uint32_t serializedSize() const;
+
+		size_t serialize(BsonSink& payload) const throw(UnavailableTypeException, BsonSink::OverflowException);
+		size_t serialize(std::vector<unsigned char>& payload) const throw(UnavailableTypeException) {
+			VectorSink sink(payload);
+			return serialize(sink);
+		}
+		/**
+		 * Same as serialize() but does not reserve the payload in advance nor commit the sink.
+		 * Used for nested documents whose parent has already reserved the whole size.
+		 */
+		size_t serializeTo(BsonSink& payload) const throw(UnavailableTypeException, BsonSink::OverflowException);
+		size_t serializeTo(std::vector<unsigned char>& payload) const throw(UnavailableTypeException) {
+			VectorSink sink(payload);
+			return serializeTo(sink);
+		}
+		/**
+		 * Decodes the document starting at offset of a raw byte range.
+		 * No byte at or beyond len is read.
+		 */
+		size_t deserialize(const uint8_t *data, size_t len, size_t offset = 0) throw (ParseException);
+		size_t deserialize(const std::vector<unsigned char>& payload, size_t offset = 0) throw (ParseException) {
+			return deserialize(payload.data(), payload.size(), offset);
+		}
+
+		/**
+		 * Decodes into the arena member types (arena::string, arena::list and so on) from arena.
+		 * Every arena container or string the document is decoded into is bound to arena first,
+		 * so the decoded values must be cleared or destroyed before arena is reset.
+		 * Deserializing without an arena binds them to the heap.
+		 */
+		size_t deserialize(const uint8_t *data, size_t len, BsonArena &arena, size_t offset = 0) throw (ParseException);
+		size_t deserialize(const std::vector<unsigned char>& payload, BsonArena &arena, size_t offset = 0) throw (ParseException) {
+			return deserialize(payload.data(), payload.size(), arena, offset);
+		}
+
+		/**
+		 * Decodes only the members selected by projection, leaving every other member as it is.
+		 */
+		size_t deserialize(const uint8_t *data, size_t len, const BsonProjection &projection, size_t offset = 0) throw (ParseException);
+		size_t deserialize(const std::vector<unsigned char>& payload, const BsonProjection &projection, size_t offset = 0) throw (ParseException) {
+			return deserialize(payload.data(), payload.size(), projection, offset);
+		}
+
+		/**
+		 * Like deserialize, but reports failure through the returned status instead of throwing.
+		 * The document is checked structurally before anything is decoded, so malformed input is rejected
+		 * without unwinding and leaves the object untouched. A member that rejects a well-formed element
+		 * yields DECODE_REJECTED, and a failed allocation DECODE_OUT_OF_MEMORY, with the object partially decoded.
+		 * The input is walked twice, once to validate and once by the regular checked decode. There is no
+		 * single pass mode that trusts the validation and drops the per element checks.
+		 */
+		DecodeStatus tryDeserialize(const uint8_t *data, size_t len, size_t offset = 0, size_t *pDocSize = NULL) throw();
+		DecodeStatus tryDeserialize(const std::vector<unsigned char>& payload, size_t offset = 0, size_t *pDocSize = NULL) throw() {
+			return tryDeserialize(payload.data(), payload.size(), offset, pDocSize);
+		}
 
 		void serializableClearObjects();
 
 		std::string serializableGetName() {
-			return m_name;
+			return serializableNameRef();
 		}
 		int64_t serializableGetSerialVersionUID() {
 			return m_serialVersionUID;
@@ -257,70 +936,213 @@ namespace JsBsonRPC {
 
 		void serializableConfigure(const DeserializationConfig &deserializationConfig, bool enable);
 
-		static bool readMetadata(const std::vector<unsigned char>& payload, size_t offset, std::string *pName = NULL, int64_t *pSerialVersionUID = NULL, uint32_t *pDocSize = NULL);
+		/**
+		 * Keeps the encoded bytes of every member and re-encodes only the members changed since the last serialize.
+		 * Members change through SType::set, operator=, ref, deserialize and clear. The output is byte-identical to a full encode.
+		 * Nested objects cache their own members only if they enable this too. SmartPointer members are always re-encoded.
+		 */
+		void serializableEnableFragmentCache(bool enable);
+		bool serializableIsFragmentCacheEnabled() const {
+			return m_fragmentCache;
+		}
+
+		/**
+		 * Reads the name and the serial version of the document at offset without decoding its members.
+		 * Reading stops as soon as both are found, which is after the first two elements for documents written by serialize().
+		 * @return true if both were found
+		 */
+		static bool readMetadata(const uint8_t *data, size_t len, size_t offset, std::string *pName = NULL, int64_t *pSerialVersionUID = NULL, uint32_t *pDocSize = NULL);
+		static bool readMetadata(const std::vector<unsigned char>& payload, size_t offset, std::string *pName = NULL, int64_t *pSerialVersionUID = NULL, uint32_t *pDocSize = NULL) {
+			return readMetadata(payload.data(), payload.size(), offset, pName, pSerialVersionUID, pDocSize);
+		}
+
+		/**
+		 * Creates the registered class named by the document metadata and decodes the document into it.
+		 * The caller owns the returned object. Returns NULL when the class is not registered.
+		 */
+		static Serializable *decodeAny(const uint8_t *data, size_t len, size_t offset = 0, size_t *pDocSize = NULL) throw (ParseException);
+		static Serializable *decodeAny(const std::vector<unsigned char>& payload, size_t offset = 0, size_t *pDocSize = NULL) throw (ParseException) {
+			return decodeAny(payload.data(), payload.size(), offset, pDocSize);
+		}
 
 	protected:
 		internal::STypeCommon &serializableMapMember(const char *name, internal::STypeCommon &object);
 
 	private:
-		bool checkFlagsAll(int value, int type) const
-		{
-			return (value & type) == type;
+		friend class BsonStreamParser;
+
+		/**
+		 * Resets the parse cursors and returns the handler that decodes into this object
+		 */
+		internal::BsonParseHandler *beginDeserialize(bool recycle);
+		/**
+		 * Clears the members the document did not contain when recycling
+		 */
+		void endDeserialize();
+		bool deserializeMember(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos);
+
+		internal::STypeCommon *findMember(const BsonStringView &name);
+		int findSchemaField(const BsonStringView &name);
+		int32_t envelopeTypeId() const;
+		void validateFragments() const;
+		const internal::STypeCommon *fragmentMember(size_t index) const;
+		uint32_t fragmentsSize() const;
+		uint32_t serializeFragments(BsonSink &payload) const;
+
+		const std::string &serializableNameRef() const {
+			return m_schema ? m_schema->name() : m_name;
 		}
 	};
 
-	namespace internal {
-		enum BsonTypes {
-			BSONTYPE_DOUBLE = 0x01,
-			BSONTYPE_STRING_UTF8 = 0x02,
-			BSONTYPE_DOCUMENT = 0x03,
-			BSONTYPE_ARRAY = 0x04,
-			BSONTYPE_BINARY = 0x05,
-			BSONTYPE_OBJECTID = 0x07,
-			BSONTYPE_BOOL = 0x08,
-			BSONTYPE_UTCDATETIME = 0x09,
-			BSONTYPE_NULL = 0x0A,
-			BSONTYPE_INT32 = 0x10,
-			BSONTYPE_TIMESTAMP = 0x11,
-			BSONTYPE_INT64 = 0x12,
-			BSONTYPE_DECIMAL128 = 0x13,
-		};
+	/**
+	 * Sub-document member that is decoded only on first access.
+	 * Deserialization records the byte range of the embedded document, get() decodes it on demand,
+	 * and serialize copies the recorded bytes as long as ref() was never called.
+	 * The recorded range points into the source payload, so it is valid only as long as the buffer
+	 * passed to deserialize() is alive and unmodified. Not thread-safe, even through get().
+	 */
+	template<typename T>
+	class Lazy
+	{
+	private:
+		mutable T m_object;
+		mutable bool m_decoded;
+		const unsigned char *m_raw;
+		uint32_t m_rawSize;
+
+		void decode() const {
+			if (!m_decoded) {
+				m_object.deserialize(m_raw, m_rawSize, 0);
+				m_decoded = true;
+			}
+		}
+
+	public:
+		Lazy() : m_decoded(true), m_raw(NULL), m_rawSize(0) {}
+
+		const T& get() const {
+			decode();
+			return m_object;
+		}
+
+		/**
+		 * Mutable access, after which the recorded bytes are dropped and the object is encoded again
+		 */
+		T& ref() {
+			decode();
+			m_raw = NULL;
+			m_rawSize = 0;
+			return m_object;
+		}
+
+		bool isDecoded() const {
+			return m_decoded;
+		}
+
+		const unsigned char *rawData() const {
+			return m_raw;
+		}
 
-		extern int _my_itoa(
-			int    value,
-			char*  buf, \
-			size_t bufSize,
-			int    radix
-		);
+		uint32_t rawSize() const {
+			return m_rawSize;
+		}
 
-		extern uint32_t serializeKey(std::vector<unsigned char> &payload, const std::string& key);
+		void assignRaw(const unsigned char *data, uint32_t size) {
+			m_raw = data;
+			m_rawSize = size;
+			m_decoded = false;
+		}
+
+		void clear() {
+			m_raw = NULL;
+			m_rawSize = 0;
+			m_decoded = true;
+			m_object.serializableClearObjects();
+		}
+	};
+
+	namespace internal {
+		extern uint32_t serializeKey(BsonSink &payload, const BsonStringView &key);
+
+		/**
+		 * Buffer for index keys that are not in the precomputed table, large enough for any uint32_t
+		 */
+		typedef char IndexKeyBuffer[11];
+
+		/**
+		 * Key of the array element at index. Keys up to "9999" point into a precomputed table,
+		 * larger ones are formatted into buf. The view is NUL terminated.
+		 */
+		extern BsonStringView indexKey(uint32_t index, IndexKeyBuffer &buf);
+
+		/**
+		 * Number of decimal digits of an array index, which is the length of its key
+		 */
+		inline size_t indexKeyLength(uint32_t index) {
+			size_t len = 1;
+			while (index >= 10) {
+				index /= 10;
+				len++;
+			}
+			return len;
+		}
 
 		template <typename T>
-		T readValue(const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
-			int i;
+		T readValue(const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
 			T value;
-			unsigned char *carr = (unsigned char*)&value;
-			if ((documentSize - *offset) < sizeof(value))
+			if ((*offset > documentSize) || ((documentSize - *offset) < sizeof(value)))
 				throw Serializable::ParseException();
-			for (i = 0; i < sizeof(value); i++)
-				carr[i] = (unsigned char)payload[(*offset)++];
+			memcpy(&value, payload + *offset, sizeof(value));
+			*offset += sizeof(value);
 			return value;
 		}
 
+		/**
+		 * Reads the size of the document at *offset and returns the end of it.
+		 * Throws unless the size is at least 5 and the document fits in documentSize.
+		 */
+		inline uint32_t readDocumentEnd(const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+			uint32_t docSize = readValue<uint32_t>(payload, offset, documentSize);
+			if ((docSize < 5) || ((docSize - 4) > (documentSize - *offset)))
+				throw Serializable::ParseException();
+			return *offset + docSize - 4;
+		}
+
+		/**
+		 * Reads the element type at *offset, returning 0 for the document terminator.
+		 * Throws if the document ends without one.
+		 */
+		inline uint8_t readElementType(const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) {
+			uint8_t type;
+			if (*offset >= docEndPos)
+				throw Serializable::ParseException();
+			type = payload[(*offset)++];
+			if ((type == 0) && (*offset != docEndPos))
+				throw Serializable::ParseException();
+			return type;
+		}
+
 		class BsonParser {
 		private:
-			uint32_t deserializationConfigs;
+			DeserializationConfig::Mask deserializationConfigs;
+			DecodeContext *context;
 
-			const std::vector<unsigned char> &payload;
+			const unsigned char *payload;
 			uint32_t docSize;
 			uint32_t rootDocSize;
 			uint32_t *offset;
 			uint32_t docEndPos;
+			bool envelope;
 
 		public:
-			BsonParser(const std::vector<unsigned char> &_payload, uint32_t rootDocSize, uint32_t *rootDocOffset, uint32_t deserializationConfigs) : payload(_payload)
+			/**
+			 * envelope is true for the document of a Serializable, whose first element may be the compact envelope
+			 */
+			BsonParser(const unsigned char *_payload, uint32_t rootDocSize, uint32_t *rootDocOffset, const DeserializationConfig::Mask &deserializationConfigs, bool envelope = false) : payload(_payload)
 			{
 				this->deserializationConfigs = deserializationConfigs;
+				this->envelope = envelope;
+				this->context = currentDecodeContext();
 				this->docSize = 0;
 				this->docEndPos = 0;
 				this->rootDocSize = rootDocSize;
@@ -330,6 +1152,42 @@ namespace JsBsonRPC {
 			uint32_t parse(BsonParseHandler *handler);
 		};
 
+		/**
+		 * Handles one element whose value starts at *offset: reports metadata, passes it to the handler or skips it.
+		 * "@t" is taken as the compact envelope only when envelope is set, which callers do for the first element
+		 * of a Serializable document. Anywhere else it is an ordinary element.
+		 */
+		extern void dispatchElement(BsonParseHandler *handler, uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos, bool envelope = false);
+
+		/**
+		 * Checks the structure of the document at offset without decoding it, never throws
+		 */
+		extern bool validateDocument(const unsigned char *payload, size_t len, size_t offset, DecodeStatus *status);
+
+		/**
+		 * Dotted element path leading to target within the document at offset, which must be valid
+		 */
+		extern std::string elementPathAt(const unsigned char *payload, size_t len, size_t offset, size_t target);
+
+		enum SkipResult {
+			SKIP_OK = 0,
+			SKIP_NEED_MORE,
+			SKIP_UNKNOWN_TYPE,
+			SKIP_BAD_LENGTH,
+		};
+
+		/**
+		 * Size of an element value of any BSON type from its leading bytes, looked up in a per type skip table.
+		 * SKIP_NEED_MORE sets *pSize to the number of bytes needed to tell when avail is not enough. Never throws.
+		 */
+		extern SkipResult skipValueSize(uint8_t type, const unsigned char *value, uint32_t avail, uint32_t *pSize);
+
+		/**
+		 * skipValueSize throwing ParseException for unknown types and bad lengths.
+		 * Returns false and sets *pSize to the number of bytes needed to tell when avail is not enough.
+		 */
+		extern bool elementValueSize(uint8_t type, const unsigned char *value, uint32_t avail, uint32_t *pSize);
+
 		template<typename T>
 		class IsSerializableSmartpointerClass
 		{
@@ -380,17 +1238,17 @@ namespace JsBsonRPC {
 #define _JSBSONRPC_MAKESERIALIZE_BASICTYPE(TYPE, BSONTYPE) \
 		template<> \
 		struct ObjectHelper<0, TYPE> { \
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const TYPE &object) { \
+			static uint32_t serializedSize(size_t keyLength, const TYPE &object) { \
+				return elementHeaderSize(keyLength) + sizeof(TYPE); \
+			} \
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const TYPE &object) { \
 				uint32_t payloadLen = 1 + sizeof(TYPE); \
-				int i; \
-				const unsigned char *carr = (const unsigned char*)&object; \
 				payload.push_back(BSONTYPE); \
 				payloadLen += serializeKey(payload, key); \
-				for(i=0; i<sizeof(TYPE); i++, carr++) \
-					payload.push_back(*carr); \
+				writeValue<TYPE>(payload, object); \
 				return payloadLen; \
 			} \
-			static uint32_t deserialize(internal::STypeCommon *rootSType, TYPE &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) { \
+			static uint32_t deserialize(internal::STypeCommon *rootSType, TYPE &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) { \
 				if(type == BSONTYPE_INT32) { \
 					object = readValue<int32_t>(payload, offset, documentSize); \
 					return sizeof(int32_t); \
@@ -415,18 +1273,18 @@ namespace JsBsonRPC {
 #define _JSBSONRPC_MAKESERIALIZE_BASICSMALLTYPE(TYPE, SERTYPE, INT32TYPE, INT64TYPE, BSONTYPE) \
 		template<> \
 		struct ObjectHelper<0, TYPE> { \
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const TYPE &object) { \
+			static uint32_t serializedSize(size_t keyLength, const TYPE &object) { \
+				return elementHeaderSize(keyLength) + sizeof(SERTYPE); \
+			} \
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const TYPE &object) { \
 				uint32_t payloadLen = 1 + sizeof(SERTYPE); \
-				int i; \
 				SERTYPE serValue = object; \
-				const unsigned char *carr = (const unsigned char*)&serValue; \
 				payload.push_back(BSONTYPE); \
 				payloadLen += serializeKey(payload, key); \
-				for(i=0; i<sizeof(serValue); i++, carr++) \
-					payload.push_back(*carr); \
+				writeValue<SERTYPE>(payload, serValue); \
 				return payloadLen; \
 			} \
-			static uint32_t deserialize(internal::STypeCommon *rootSType, TYPE &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) { \
+			static uint32_t deserialize(internal::STypeCommon *rootSType, TYPE &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) { \
 				if(type == BSONTYPE_INT32) { \
 					object = readValue<INT32TYPE>(payload, offset, documentSize); \
 					return sizeof(int32_t); \
@@ -460,18 +1318,18 @@ namespace JsBsonRPC {
 
 		template<>
 		struct ObjectHelper<0, float> {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const float &object) {
+			static uint32_t serializedSize(size_t keyLength, const float &object) {
+				return elementHeaderSize(keyLength) + sizeof(double);
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const float &object) {
 				uint32_t payloadLen = 1 + sizeof(double);
-				int i;
 				double dblValue = object;
-				const unsigned char *carr = (const unsigned char*)& dblValue;
 				payload.push_back(BSONTYPE_DOUBLE);
 				payloadLen += serializeKey(payload, key);
-				for (i = 0; i<sizeof(dblValue); i++, carr++)
-					payload.push_back(*carr);
+				writeValue<double>(payload, dblValue);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, float &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
+			static uint32_t deserialize(internal::STypeCommon *rootSType, float &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
 				if (type == BSONTYPE_INT32) {
 					object = readValue<int32_t>(payload, offset, documentSize);
 					return sizeof(int32_t);
@@ -501,14 +1359,17 @@ namespace JsBsonRPC {
 
 		template<>
 		struct ObjectHelper<0, bool> {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const bool &object) {
+			static uint32_t serializedSize(size_t keyLength, const bool &object) {
+				return elementHeaderSize(keyLength) + 1;
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const bool &object) {
 				uint32_t payloadLen = 2;
 				payload.push_back(internal::BSONTYPE_BOOL);
 				payloadLen += serializeKey(payload, key);
 				payload.push_back(object ? 1 : 0);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, bool &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
+			static uint32_t deserialize(internal::STypeCommon *rootSType, bool &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
 				if (type == BSONTYPE_BOOL) {
 					object = readValue<unsigned char>(payload, offset, documentSize) ? true : false;
 					return 1;
@@ -526,31 +1387,65 @@ namespace JsBsonRPC {
 			}
 		};
 
-		template<>
-		struct ObjectHelper<0, std::string> {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const std::string &object) {
+		template<typename A>
+		struct IsArenaAllocator {
+			enum { Result = 0 };
+		};
+
+		template<typename T>
+		struct IsArenaAllocator< ArenaAllocator<T> > {
+			enum { Result = 1 };
+		};
+
+		/**
+		 * Binds a container or string with an ArenaAllocator to the arena of the current deserialization before
+		 * anything is decoded into it. One bound elsewhere, or to the arena before its last reset, is replaced
+		 * by an empty one, so its elements are decoded anew.
+		 * Other allocators are left alone.
+		 */
+		template<typename C, bool Arena = IsArenaAllocator<typename C::allocator_type>::Result>
+		struct ArenaBinding {
+			static void bind(C &object) {}
+		};
+
+		template<typename C>
+		struct ArenaBinding<C, true> {
+			static void bind(C &object) {
+				typename C::allocator_type allocator(currentArena());
+				if (object.get_allocator() != allocator)
+					object = C(allocator);
+			}
+		};
+
+		/**
+		 * std::string, or any std::basic_string<char> such as an arena allocated one
+		 */
+		template<typename Traits, typename Alloc>
+		struct ObjectHelper<0, std::basic_string<char, Traits, Alloc> > {
+			typedef std::basic_string<char, Traits, Alloc> String;
+			static uint32_t serializedSize(size_t keyLength, const String &object) {
+				return elementHeaderSize(keyLength) + 4 + object.length() + 1;
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const String &object) {
 				uint32_t len = object.length() + 1;
 				uint32_t payloadLen = 5 + len;
 				payload.push_back(internal::BSONTYPE_STRING_UTF8);
 				payloadLen += serializeKey(payload, key);
-				payload.push_back((unsigned char)(len >> 0));
-				payload.push_back((unsigned char)(len >> 8));
-				payload.push_back((unsigned char)(len >> 16));
-				payload.push_back((unsigned char)(len >> 24));
-				payload.insert(payload.end(), object.begin(), object.end());
-				payload.push_back(0);
+				writeValue<uint32_t>(payload, len);
+				writeBytes(payload, object.c_str(), len);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, std::string &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
+			static uint32_t deserialize(internal::STypeCommon *rootSType, String &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
 				uint32_t payloadSize = 0;
 				if (type == BSONTYPE_STRING_UTF8) {
 					uint32_t len = readValue<uint32_t>(payload, offset, documentSize);
-					if ((documentSize - *offset) < len)
+					if ((len == 0) || ((documentSize - *offset) < len))
 						throw Serializable::ParseException();
+					ArenaBinding<String>::bind(object);
 					if(payload[*offset + len - 1] == 0)
-						object = std::string((const char*)&payload[*offset], len - 1);
+						object.assign((const char*)&payload[*offset], len - 1);
 					else
-						object = std::string((const char*)&payload[*offset], len);
+						object.assign((const char*)&payload[*offset], len);
 					*offset += len;
 					payloadSize = 4 + len;
 				} else {
@@ -558,52 +1453,109 @@ namespace JsBsonRPC {
 				}
 				return payloadSize;
 			}
-			static void objectClear(std::string &object) {
+			static void objectClear(String &object) {
 				object.clear();
 			}
 		};
 
-		template<typename T>
-		struct ObjectHelper< 0, std::vector<T> > {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const std::vector<T> &object) {
-				size_t i, len = object.size();
+		/**
+		 * Borrowed string member : after deserialize the view points into the source payload and nothing is allocated.
+		 * The decoded value is valid only as long as the buffer passed to deserialize() is alive and unmodified.
+		 * On serialize the viewed bytes must still be valid.
+		 */
+		template<>
+		struct ObjectHelper<0, BsonStringView> {
+			static uint32_t serializedSize(size_t keyLength, const BsonStringView &object) {
+				return elementHeaderSize(keyLength) + 4 + object.length() + 1;
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const BsonStringView &object) {
+				uint32_t len = object.length() + 1;
+				uint32_t payloadLen = 5 + len;
+				payload.push_back(internal::BSONTYPE_STRING_UTF8);
+				payloadLen += serializeKey(payload, key);
+				writeValue<uint32_t>(payload, len);
+				writeBytes(payload, object.data(), object.length());
+				payload.push_back(0);
+				return payloadLen;
+			}
+			static uint32_t deserialize(internal::STypeCommon *rootSType, BsonStringView &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				uint32_t len;
+				if (type != BSONTYPE_STRING_UTF8)
+					throw Serializable::ParseException();
+				len = readValue<uint32_t>(payload, offset, documentSize);
+				if ((len == 0) || ((documentSize - *offset) < len))
+					throw Serializable::ParseException();
+				if (payload[*offset + len - 1] == 0)
+					object = BsonStringView((const char*)&payload[*offset], len - 1);
+				else
+					object = BsonStringView((const char*)&payload[*offset], len);
+				*offset += len;
+				return 4 + len;
+			}
+			static void objectClear(BsonStringView &object) {
+				object = BsonStringView();
+			}
+		};
+
+		/**
+		 * Element copy of a BSON binary array, one memcpy each way
+		 */
+		template<typename V>
+		struct BinaryArrayHelper {
+			typedef typename V::value_type T;
+			static_assert(std::is_trivially_copyable<T>::value, "binary arrays hold trivially copyable elements only");
+			static void write(BsonSink &payload, const V &object) {
+				if (!object.empty())
+					payload.write(&object[0], object.size() * sizeof(T));
+			}
+			static void read(V &object, const unsigned char *data, uint32_t cnt) {
+				object.resize(cnt);
+				if (cnt)
+					memcpy(&object[0], data, cnt * sizeof(T));
+			}
+		};
+
+		/**
+		 * std::vector of trivially copyable elements, encoded as one BSON binary
+		 */
+		template<typename V>
+		struct BinaryVectorHelper {
+			typedef typename V::value_type T;
+			static uint32_t serializedSize(size_t keyLength, const V &object) {
+				return elementHeaderSize(keyLength) + 5 + object.size() * sizeof(T);
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const V &object) {
+				size_t len = object.size();
 				uint32_t totallen = len * sizeof(T);
 				uint32_t payloadLen = totallen + 6;
 				payload.push_back(internal::BSONTYPE_BINARY);
 				payloadLen += serializeKey(payload, key);
-				payload.push_back((unsigned char)(len >> 0));
-				payload.push_back((unsigned char)(len >> 8));
-				payload.push_back((unsigned char)(len >> 16));
-				payload.push_back((unsigned char)(len >> 24));
+				writeValue<uint32_t>(payload, totallen);
 				payload.push_back(0x00); // Generic binary subtype
-				for (i = 0; i < len; i++)
-				{
-					int j;
-					const unsigned char *carr = (const unsigned char*)&object[i];
-					for (j = 0; j < sizeof(T); j++)
-						payload.push_back(carr[j]);
-				}
+				BinaryArrayHelper<V>::write(payload, object);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, std::vector<T> &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
+			static uint32_t deserialize(internal::STypeCommon *rootSType, V &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
 				uint32_t payloadSize = 0;
-				object.clear();
 				if (type == BSONTYPE_BINARY) {
 					uint32_t len = readValue<uint32_t>(payload, offset, documentSize);
 					uint8_t subtype = readValue<uint8_t>(payload, offset, documentSize);
 					uint32_t cnt = len / sizeof(T);
-					uint32_t i;
-					object.clear();
-					payloadSize = 5 + cnt * sizeof(T);
-					for (i = 0; i < cnt; i++) {
-						object.push_back(readValue<T>(payload, offset, documentSize));
-					}
+					if ((documentSize - *offset) < len)
+						throw Serializable::ParseException();
+					ArenaBinding<V>::bind(object);
+					BinaryArrayHelper<V>::read(object, payload + *offset, cnt);
+					*offset += len;
+					payloadSize = 5 + len;
 #if defined(HAS_JSCPPUTILS) && HAS_JSCPPUTILS
 				} else if (type == BSONTYPE_STRING_UTF8) {
 					// BASE64
 					std::vector<unsigned char> buffer;
+					object.clear();
 					uint32_t len = readValue<uint32_t>(payload, offset, documentSize);
 					uint32_t realLen = len;
+					if ((len == 0) || ((documentSize - *offset) < len))
+						throw Serializable::ParseException();
 					if (payload[*offset + len - 1] == 0)
 						realLen--;
 					JsCPPUtils::Base64::decode(buffer, (const char*)&payload[*offset], realLen);
@@ -616,68 +1568,229 @@ namespace JsBsonRPC {
 				}
 				return payloadSize;
 			}
-			static void objectClear(std::vector<T> &object) {
+			static void objectClear(V &object) {
 				object.clear();
 			}
 		};
 
+		/**
+		 * Borrowed binary member, with the same lifetime contract as BsonStringView
+		 */
+		template<>
+		struct ObjectHelper<0, BsonBinaryView> {
+			static uint32_t serializedSize(size_t keyLength, const BsonBinaryView &object) {
+				return elementHeaderSize(keyLength) + 5 + object.length();
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const BsonBinaryView &object) {
+				uint32_t len = object.length();
+				uint32_t payloadLen = 6 + len;
+				payload.push_back(internal::BSONTYPE_BINARY);
+				payloadLen += serializeKey(payload, key);
+				writeValue<uint32_t>(payload, len);
+				payload.push_back(object.subtype());
+				writeBytes(payload, object.data(), len);
+				return payloadLen;
+			}
+			static uint32_t deserialize(internal::STypeCommon *rootSType, BsonBinaryView &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				uint32_t len;
+				uint8_t subtype;
+				if (type != BSONTYPE_BINARY)
+					throw Serializable::ParseException();
+				len = readValue<uint32_t>(payload, offset, documentSize);
+				subtype = readValue<uint8_t>(payload, offset, documentSize);
+				if ((documentSize - *offset) < len)
+					throw Serializable::ParseException();
+				object = BsonBinaryView(&payload[*offset], len, subtype);
+				*offset += len;
+				return 5 + len;
+			}
+			static void objectClear(BsonBinaryView &object) {
+				object = BsonBinaryView();
+			}
+		};
+
+		extern uint32_t countElements(const unsigned char *payload, uint32_t offset, uint32_t documentSize);
+
+		/**
+		 * Scratch list of the map entries a recycled document was decoded into, one per nesting level
+		 * so that nested maps do not share it. The lists keep their capacity, so steady state decoding does not allocate.
+		 */
+		class VisitedEntries
+		{
+		private:
+			std::vector<const void*> &m_entries;
+
+			VisitedEntries(const VisitedEntries &obj);
+			VisitedEntries &operator=(const VisitedEntries &obj);
+
+		public:
+			VisitedEntries();
+			~VisitedEntries();
+
+			void add(const void *entry) {
+				m_entries.push_back(entry);
+			}
+
+			/**
+			 * Sorts the list and drops repeated entries, so it can be searched with contains()
+			 */
+			size_t distinct();
+			bool contains(const void *entry) const;
+		};
+
+		/**
+		 * Sizes a container before an array or document is decoded into it.
+		 * Only containers that can use the element count pay for counting.
+		 */
+		template<typename C>
+		struct ContainerReserve {
+			static void apply(C &object, const unsigned char *payload, uint32_t offset, uint32_t documentSize) {}
+		};
+
+		template<typename T, typename Alloc>
+		struct ContainerReserve< std::vector<T, Alloc> > {
+			static void apply(std::vector<T, Alloc> &object, const unsigned char *payload, uint32_t offset, uint32_t documentSize) {
+				object.reserve(countElements(payload, offset, documentSize));
+			}
+		};
+
+		template<typename Key, typename T, typename Hash, typename Pred, typename Alloc>
+		struct ContainerReserve< std::unordered_map<Key, T, Hash, Pred, Alloc> > {
+			static void apply(std::unordered_map<Key, T, Hash, Pred, Alloc> &object, const unsigned char *payload, uint32_t offset, uint32_t documentSize) {
+				object.reserve(countElements(payload, offset, documentSize));
+			}
+		};
+
 		template<typename T>
-		struct ObjectHelper< 0, std::list<T> > : public BsonParseHandler {
-			internal::STypeCommon *rootSType;
-			std::list<T> &refObject;
-			ObjectHelper(internal::STypeCommon *_rootSType, std::list<T> &object) : rootSType(_rootSType), refObject(object) {}
+		struct ContainerReserve< SortedKeysUnorderedMap<T> > {
+			static void apply(SortedKeysUnorderedMap<T> &object, const unsigned char *payload, uint32_t offset, uint32_t documentSize) {
+				object.reserve(countElements(payload, offset, documentSize));
+			}
+		};
+
+		/**
+		 * Sequence container (std::list, std::deque, std::vector of non trivially copyable elements) encoded as a BSON array
+		 */
+		template<typename C>
+		struct ArrayObjectHelper : public BsonParseHandler {
+			typedef typename C::value_type T;
 
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const std::list<T> &object) {
+			internal::STypeCommon *rootSType;
+			C &refObject;
+			/**
+			 * Next existing element to overwrite, until the container runs out and elements are appended
+			 */
+			typename C::iterator next;
+			bool appending;
+			ArrayObjectHelper(internal::STypeCommon *_rootSType, C &object, bool recycle) : rootSType(_rootSType), refObject(object), next(object.begin()), appending(!recycle) {}
+
+			static uint32_t serializedSize(size_t keyLength, const C &object) {
+				uint32_t subDocumentSize = 5;
+				uint32_t i = 0;
+				for (typename C::const_iterator iter = object.begin(); iter != object.end(); iter++, i++)
+				{
+					subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serializedSize(indexKeyLength(i), *iter);
+				}
+				return elementHeaderSize(keyLength) + subDocumentSize;
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const C &object) {
 				size_t offset;
-				char seqKey[32];
-				int i = 0;
+				IndexKeyBuffer keyBuffer;
+				uint32_t i = 0;
 				uint32_t payloadLen = 1;
 				uint32_t subDocumentSize = 5;
 				payload.push_back(internal::BSONTYPE_ARRAY);
 				payloadLen += serializeKey(payload, key);
 				offset = payload.size();
 				// DOCUMENT HEADER : SIZE
-				payload.push_back(0); payload.push_back(0); payload.push_back(0); payload.push_back(0);
-				for (typename std::list<T>::const_iterator iter = object.begin(); iter != object.end(); iter++)
+				writeValue<uint32_t>(payload, 0);
+				for (typename C::const_iterator iter = object.begin(); iter != object.end(); iter++)
 				{
 					// doucment
-					_my_itoa(i, seqKey, sizeof(seqKey), 10);
-					subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, seqKey, *iter);
+					subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, indexKey(i, keyBuffer), *iter);
 					i++;
 				}
 				// DOCUMENT FOOTER : END
 				payload.push_back(0);
-				payload[offset + 0] = ((unsigned char)(subDocumentSize >> 0));
-				payload[offset + 1] = ((unsigned char)(subDocumentSize >> 8));
-				payload[offset + 2] = ((unsigned char)(subDocumentSize >> 16));
-				payload[offset + 3] = ((unsigned char)(subDocumentSize >> 24));
+				patchValue<uint32_t>(payload, offset, subDocumentSize);
 				payloadLen += subDocumentSize;
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, std::list<T> &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
-				BsonParser parser(payload, documentSize, offset, DeserializationConfig::getDefaultConfigure());
-				ObjectHelper< 0, std::list<T> > helper(rootSType, object);
-				object.clear();
-				return parser.parse(&helper);
+			static uint32_t deserialize(internal::STypeCommon *rootSType, C &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				BsonParser parser(payload, documentSize, offset, currentConfigs());
+				bool recycle = isRecycling();
+				uint32_t docSize;
+				ArenaBinding<C>::bind(object);
+				if (!recycle) {
+					object.clear();
+					ContainerReserve<C>::apply(object, payload, *offset, documentSize);
+				}
+				ArrayObjectHelper<C> helper(rootSType, object, recycle);
+				docSize = parser.parse(&helper);
+				if (!helper.appending)
+					object.erase(helper.next, object.end());
+				return docSize;
 			}
-			static void objectClear(std::list<T> &object) {
+			static void objectClear(C &object) {
 				object.clear();
 			}
-			bool bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) override {
-				T temp;
-				ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(rootSType, temp, type, payload, offset, docEndPos);
-				refObject.push_back(temp);
+			bool bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) override {
+				if (!appending) {
+					if (next != refObject.end()) {
+						ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(rootSType, *next, type, payload, offset, docEndPos);
+						++next;
+						return true;
+					}
+					appending = true;
+				}
+				// Decode in place, so Serializable elements are never copied
+				refObject.emplace_back();
+				try {
+					ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(rootSType, refObject.back(), type, payload, offset, docEndPos);
+				} catch (...) {
+					refObject.pop_back();
+					throw;
+				}
 				return true;
 			};
 		};
 
-		template<typename T>
-		struct ObjectHelper< 0, std::map<std::string, T> > : public BsonParseHandler {
+		/**
+		 * String keyed map encoded as a BSON document.
+		 * With SortedKeys the elements are emitted in key order whatever the iteration order of the map is.
+		 */
+		template<typename M, bool SortedKeys = false>
+		struct DocumentObjectHelper : public BsonParseHandler {
+			typedef typename M::key_type Key;
+			typedef typename M::mapped_type T;
+			typedef typename M::value_type Entry;
+
 			internal::STypeCommon *rootSType;
-			std::map<std::string, T> &refObject;
-			ObjectHelper(internal::STypeCommon *_rootSType, std::map<std::string, T> &object) : rootSType(_rootSType), refObject(object) {}
+			M &refObject;
+			/**
+			 * Values the document was decoded into when recycling, NULL otherwise
+			 */
+			VisitedEntries *visited;
+			/**
+			 * Holds the name of the element being decoded, so that looking up an existing entry does not allocate
+			 */
+			Key keyBuffer;
+			DocumentObjectHelper(internal::STypeCommon *_rootSType, M &object, VisitedEntries *_visited)
+				: rootSType(_rootSType), refObject(object), visited(_visited), keyBuffer(typename Key::allocator_type(object.get_allocator())) {}
+
+			static bool entryKeyLess(const Entry *a, const Entry *b) {
+				return a->first < b->first;
+			}
 
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const std::map<std::string, T> &object) {
+			static uint32_t serializedSize(size_t keyLength, const M &object) {
+				uint32_t subDocumentSize = 5;
+				for (typename M::const_iterator iter = object.begin(); iter != object.end(); iter++)
+				{
+					subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serializedSize(iter->first.length(), iter->second);
+				}
+				return elementHeaderSize(keyLength) + subDocumentSize;
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const M &object) {
 				size_t offset;
 				uint32_t payloadLen = 1;
 				uint32_t subDocumentSize = 5;
@@ -686,47 +1799,118 @@ namespace JsBsonRPC {
 				offset = payload.size();
 
 				// DOCUMENT HEADER : SIZE
-				payload.push_back(0); payload.push_back(0); payload.push_back(0); payload.push_back(0);
-				for (typename std::map<std::string, T>::const_iterator iter = object.begin(); iter != object.end(); iter++)
-				{
-					// doucment
-					subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, iter->first, iter->second);
+				writeValue<uint32_t>(payload, 0);
+				if (SortedKeys) {
+					std::vector<const Entry*> entries;
+					entries.reserve(object.size());
+					for (typename M::const_iterator iter = object.begin(); iter != object.end(); iter++)
+						entries.push_back(&(*iter));
+					std::sort(entries.begin(), entries.end(), entryKeyLess);
+					for (typename std::vector<const Entry*>::const_iterator iter = entries.begin(); iter != entries.end(); iter++)
+					{
+						subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, (*iter)->first, (*iter)->second);
+					}
+				} else {
+					for (typename M::const_iterator iter = object.begin(); iter != object.end(); iter++)
+					{
+						// doucment
+						subDocumentSize += ObjectHelper<internal::IsSerializableClass<T>::Result, T>::serialize(payload, iter->first, iter->second);
+					}
 				}
 				// DOCUMENT FOOTER : END
 				payload.push_back(0);
-				payload[offset + 0] = ((unsigned char)(subDocumentSize >> 0));
-				payload[offset + 1] = ((unsigned char)(subDocumentSize >> 8));
-				payload[offset + 2] = ((unsigned char)(subDocumentSize >> 16));
-				payload[offset + 3] = ((unsigned char)(subDocumentSize >> 24));
+				patchValue<uint32_t>(payload, offset, subDocumentSize);
 				payloadLen += subDocumentSize;
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, std::map<std::string, T> &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
-				BsonParser parser(payload, documentSize, offset, DeserializationConfig::getDefaultConfigure());
-				ObjectHelper< 0, std::map<std::string, T> > helper(rootSType, object);
-				object.clear();
-				return parser.parse(&helper);
+			static uint32_t deserialize(internal::STypeCommon *rootSType, M &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				BsonParser parser(payload, documentSize, offset, currentConfigs());
+				uint32_t docSize;
+				ArenaBinding<M>::bind(object);
+				if (!isRecycling()) {
+					object.clear();
+					ContainerReserve<M>::apply(object, payload, *offset, documentSize);
+					DocumentObjectHelper<M, SortedKeys> helper(rootSType, object, NULL);
+					return parser.parse(&helper);
+				}
+				VisitedEntries visited;
+				DocumentObjectHelper<M, SortedKeys> helper(rootSType, object, &visited);
+				docSize = parser.parse(&helper);
+				// Counted by entry rather than by element, a key repeated in the document must not hide a stale entry
+				if (visited.distinct() != object.size()) {
+					for (typename M::iterator iter = object.begin(); iter != object.end(); ) {
+						if (!visited.contains(&iter->second))
+							iter = object.erase(iter);
+						else
+							iter++;
+					}
+				}
+				return docSize;
 			}
-			static void objectClear(std::map<std::string, T> &object) {
+			static void objectClear(M &object) {
 				object.clear();
 			}
-			bool bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) override {
-				ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(rootSType, refObject[name], type, payload, offset, docEndPos);
+			bool bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) override {
+				T *value = NULL;
+				keyBuffer.assign(name.data(), name.length());
+				if (visited) {
+					// A key is only copied into the map when its entry is new
+					typename M::iterator iter = refObject.find(keyBuffer);
+					if (iter != refObject.end())
+						value = &iter->second;
+				}
+				if (!value)
+					value = &refObject[keyBuffer];
+				if (visited)
+					visited->add(value);
+				ObjectHelper<internal::IsSerializableClass<T>::Result, T>::deserialize(rootSType, *value, type, payload, offset, docEndPos);
 				return true;
 			};
 		};
 
+		// Containers, and the string keys of maps, are matched with any allocator, so arena containers decode in place
+
+		template<typename T, typename Alloc>
+		struct ObjectHelper< 0, std::vector<T, Alloc> > : public std::conditional< std::is_trivially_copyable<T>::value, BinaryVectorHelper< std::vector<T, Alloc> >, ArrayObjectHelper< std::vector<T, Alloc> > >::type {
+		};
+
+		template<typename T, typename Alloc>
+		struct ObjectHelper< 0, std::list<T, Alloc> > : public ArrayObjectHelper< std::list<T, Alloc> > {
+		};
+
+		template<typename T, typename Alloc>
+		struct ObjectHelper< 0, std::deque<T, Alloc> > : public ArrayObjectHelper< std::deque<T, Alloc> > {
+		};
+
+		template<typename KeyTraits, typename KeyAlloc, typename T, typename Compare, typename Alloc>
+		struct ObjectHelper< 0, std::map<std::basic_string<char, KeyTraits, KeyAlloc>, T, Compare, Alloc> > : public DocumentObjectHelper< std::map<std::basic_string<char, KeyTraits, KeyAlloc>, T, Compare, Alloc> > {
+		};
+
+		template<typename KeyTraits, typename KeyAlloc, typename T, typename Hash, typename Pred, typename Alloc>
+		struct ObjectHelper< 0, std::unordered_map<std::basic_string<char, KeyTraits, KeyAlloc>, T, Hash, Pred, Alloc> > : public DocumentObjectHelper< std::unordered_map<std::basic_string<char, KeyTraits, KeyAlloc>, T, Hash, Pred, Alloc> > {
+		};
+
+		template<typename T>
+		struct ObjectHelper< 0, SortedKeysUnorderedMap<T> > : public DocumentObjectHelper< SortedKeysUnorderedMap<T>, true > {
+		};
+
 		template<typename T>
 		struct ObjectHelper<1, T> {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const Serializable &object) {
+			static uint32_t serializedSize(size_t keyLength, const Serializable &object) {
+				return elementHeaderSize(keyLength) + object.serializedSize();
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const Serializable &object) {
 				size_t payloadLen = 1;
 				payload.push_back(internal::BSONTYPE_DOCUMENT);
 				payloadLen += serializeKey(payload, key);
-				payloadLen += object.serialize(payload);
+				payloadLen += object.serializeTo(payload);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, Serializable &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
-				uint32_t payloadLen = object.deserialize(payload, *offset);
+			static uint32_t deserialize(internal::STypeCommon *rootSType, Serializable &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				uint32_t payloadLen;
+				if (type != BSONTYPE_DOCUMENT)
+					throw Serializable::ParseException();
+				payloadLen = object.deserialize(payload, documentSize, *offset);
 				*offset += payloadLen;
 				return payloadLen;
 			}
@@ -735,25 +1919,68 @@ namespace JsBsonRPC {
 			}
 		};
 
+		template<typename T>
+		struct ObjectHelper< 0, Lazy<T> > {
+			static uint32_t serializedSize(size_t keyLength, const Lazy<T> &object) {
+				if (object.rawData())
+					return elementHeaderSize(keyLength) + object.rawSize();
+				return elementHeaderSize(keyLength) + object.get().serializedSize();
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const Lazy<T> &object) {
+				size_t payloadLen = 1;
+				payload.push_back(internal::BSONTYPE_DOCUMENT);
+				payloadLen += serializeKey(payload, key);
+				if (object.rawData()) {
+					writeBytes(payload, object.rawData(), object.rawSize());
+					payloadLen += object.rawSize();
+				} else {
+					payloadLen += object.get().serializeTo(payload);
+				}
+				return payloadLen;
+			}
+			static uint32_t deserialize(internal::STypeCommon *rootSType, Lazy<T> &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				uint32_t docOffset = *offset;
+				uint32_t docSize;
+				if (type != BSONTYPE_DOCUMENT)
+					throw Serializable::ParseException();
+				docSize = readValue<uint32_t>(payload, &docOffset, documentSize);
+				if ((docSize < 5) || ((documentSize - *offset) < docSize))
+					throw Serializable::ParseException();
+				object.assignRaw(payload + *offset, docSize);
+				*offset += docSize;
+				return docSize;
+			}
+			static void objectClear(Lazy<T> &object) {
+				object.clear();
+			}
+		};
+
 #if defined(HAS_JSCPPUTILS) && HAS_JSCPPUTILS
 		template<typename T>
 		struct ObjectHelper<1, JsCPPUtils::SmartPointer<T> > {
-			static uint32_t serialize(std::vector<unsigned char> &payload, const std::string& key, const JsCPPUtils::SmartPointer<T> &object) {
+			static uint32_t serializedSize(size_t keyLength, const JsCPPUtils::SmartPointer<T> &object) {
+				if (!object)
+					return elementHeaderSize(keyLength);
+				return elementHeaderSize(keyLength) + object->serializedSize();
+			}
+			static uint32_t serialize(BsonSink &payload, const BsonStringView &key, const JsCPPUtils::SmartPointer<T> &object) {
 				size_t payloadLen = 1;
 				if (!object) {
 					return serializeNullObject(payload, key);
 				}
 				payload.push_back(internal::BSONTYPE_DOCUMENT);
 				payloadLen += serializeKey(payload, key);
-				payloadLen += object->serialize(payload);
+				payloadLen += object->serializeTo(payload);
 				return payloadLen;
 			}
-			static uint32_t deserialize(internal::STypeCommon *rootSType, JsCPPUtils::SmartPointer<T> &object, uint8_t type, const std::vector<unsigned char> &payload, uint32_t *offset, uint32_t documentSize) {
+			static uint32_t deserialize(internal::STypeCommon *rootSType, JsCPPUtils::SmartPointer<T> &object, uint8_t type, const unsigned char *payload, uint32_t *offset, uint32_t documentSize) {
+				if (type != BSONTYPE_DOCUMENT)
+					throw Serializable::ParseException();
 				if (rootSType->getSerializableSmartpointerCreateFactory())
 				{
 					std::string sname;
 					int64_t sver;
-					Serializable::readMetadata(payload, *offset, &sname, &sver);
+					Serializable::readMetadata(payload, documentSize, *offset, &sname, &sver);
 					JsCPPUtils::SmartPointer<Serializable> newObj = rootSType->getSerializableSmartpointerCreateFactory()->create(sname, sver);
 					if (!newObj)
 						newObj = rootSType->getSerializableSmartpointerCreateFactory()->create();
@@ -761,8 +1988,25 @@ namespace JsBsonRPC {
 						object.attach(newObj.detach());
 					}
 				}
+				else
+				{
+					// No factory: the registry picks the class named by the document, if it is a T
+					std::string sname;
+					int64_t sver;
+					if (Serializable::readMetadata(payload, documentSize, *offset, &sname, &sver))
+					{
+						Serializable *created = SerializableRegistry::create(sname, sver);
+						T *typed = dynamic_cast<T*>(created);
+						if (typed)
+							object.attach(typed);
+						else
+							delete created;
+					}
+				}
+				if (!object)
+					throw Serializable::ParseException();
 				
-				uint32_t payloadLen = object->deserialize(payload, *offset);
+				uint32_t payloadLen = object->deserialize(payload, documentSize, *offset);
 				*offset += payloadLen;
 				return payloadLen;
 			}
@@ -0,0 +1,57 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	bench_util.h
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ *
+ * Timing and before/after report shared by the benchmarks.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+
+namespace bench {
+
+	/**
+	 * Average wall time of one call of func, in microseconds
+	 */
+	template<typename F>
+	double measure(int iterations, F func)
+	{
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			func();
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::micro>(end - begin).count() / iterations;
+	}
+
+	inline void printHeader(const char *caseName, const char *sizeName, const char *beforeName, const char *afterName)
+	{
+		printf("%-16s %10s %14s %14s %8s\n", caseName, sizeName, beforeName, afterName, "speedup");
+	}
+
+	inline void printResult(const char *caseName, size_t size, double before, double after)
+	{
+		printf("%-16s %10zu %14.3f %14.3f %7.2fx\n", caseName, size, before, after, before / after);
+	}
+
+}
@@ -0,0 +1,110 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	binary_array_bench.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ *
+ * Copies std::vector<int32_t> and std::vector<double> payloads to and from a BSON binary,
+ * once with the single memcpy of BinaryArrayHelper and once element by element.
+ *
+ *   c++ -O2 -std=c++14 -I.. binary_array_bench.cpp ../Serializable.cpp ../BsonSink.cpp ../BsonArena.cpp -o binary_array_bench
+ */
+
+#include "../Serializable.h"
+#include "bench_util.h"
+
+namespace {
+
+	/**
+	 * Element by element copy, as the binary array was encoded and decoded before
+	 */
+	template<typename V>
+	struct PerElement {
+		typedef typename V::value_type T;
+		static void write(JsBsonRPC::BsonSink &payload, const V &object) {
+			for (size_t i = 0; i < object.size(); i++)
+				JsBsonRPC::internal::writeValue<T>(payload, object[i]);
+		}
+		static void read(V &object, const unsigned char *data, uint32_t cnt) {
+			object.clear();
+			object.reserve(cnt);
+			for (uint32_t i = 0; i < cnt; i++) {
+				T value;
+				memcpy(&value, data + i * sizeof(T), sizeof(T));
+				object.push_back(value);
+			}
+		}
+	};
+
+	template<typename T>
+	void run(const char *typeName, size_t count)
+	{
+		typedef std::vector<T> V;
+		typedef JsBsonRPC::internal::BinaryArrayHelper<V> Bulk;
+		V source(count);
+		V decoded;
+		std::vector<unsigned char> payload;
+		int iterations = (int)((512 * 1024 * 1024) / (count * sizeof(T)));
+		std::string writeCase = std::string(typeName) + " write";
+		std::string readCase = std::string(typeName) + " read";
+		double writeBefore, writeAfter, readBefore, readAfter;
+		for (size_t i = 0; i < count; i++)
+			source[i] = (T)i;
+		if (iterations < 1)
+			iterations = 1;
+
+		writeBefore = bench::measure(iterations, [&]() {
+			payload.clear();
+			JsBsonRPC::VectorSink sink(payload);
+			sink.reserve(count * sizeof(T));
+			PerElement<V>::write(sink, source);
+		});
+		writeAfter = bench::measure(iterations, [&]() {
+			payload.clear();
+			JsBsonRPC::VectorSink sink(payload);
+			sink.reserve(count * sizeof(T));
+			Bulk::write(sink, source);
+		});
+		readBefore = bench::measure(iterations, [&]() {
+			decoded = V();
+			PerElement<V>::read(decoded, payload.data(), (uint32_t)count);
+		});
+		readAfter = bench::measure(iterations, [&]() {
+			decoded = V();
+			Bulk::read(decoded, payload.data(), (uint32_t)count);
+		});
+		bench::printResult(writeCase.c_str(), count * sizeof(T), writeBefore, writeAfter);
+		bench::printResult(readCase.c_str(), count * sizeof(T), readBefore, readAfter);
+	}
+}
+
+int main()
+{
+	static const size_t counts[] = { 256, 64 * 1024, 4 * 1024 * 1024 };
+
+	bench::printHeader("array", "bytes", "per-element us", "memcpy us");
+	for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		run<int32_t>("int32_t", counts[i]);
+		run<double>("double", counts[i]);
+	}
+	return 0;
+}
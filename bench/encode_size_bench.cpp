@@ -0,0 +1,124 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	encode_size_bench.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ *
+ * Encodes documents of 1 KB, 64 KB and 8 MB through serialize(std::vector&), which reserves the exact size
+ * computed by serializedSize() once, and through a sink that grows an unreserved vector one byte at a time
+ * as serialize did before the size pre-pass.
+ *
+ *   c++ -O2 -std=c++14 -I.. encode_size_bench.cpp ../Serializable.cpp ../BsonSink.cpp ../BsonArena.cpp -o encode_size_bench
+ */
+
+#include "../Serializable.h"
+#include "bench_util.h"
+
+namespace {
+
+	class BenchDocument : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int64_t> id;
+		JsBsonRPC::SType<std::string> name;
+		JsBsonRPC::SType< std::list<std::string> > items;
+		JsBsonRPC::SType< std::list<int32_t> > values;
+
+		BenchDocument() : Serializable("bench", 1) {
+			serializableMapMember("id", id);
+			serializableMapMember("name", name);
+			serializableMapMember("items", items);
+			serializableMapMember("values", values);
+		}
+	};
+
+	/**
+	 * No write window : every byte goes through overflow() and one push_back into a vector that was never reserved
+	 */
+	class ByteAppendSink : public JsBsonRPC::BsonSink
+	{
+	private:
+		std::vector<unsigned char> &m_payload;
+
+	protected:
+		void overflow(const unsigned char *data, size_t len) override {
+			for (size_t i = 0; i < len; i++)
+				m_payload.push_back(data[i]);
+			m_windowOffset = m_payload.size();
+		}
+
+	public:
+		ByteAppendSink(std::vector<unsigned char> &payload) : m_payload(payload) {
+			m_windowOffset = payload.size();
+		}
+
+		void patch(size_t pos, const void *data, size_t len) override {
+			memcpy(&m_payload[pos], data, len);
+		}
+	};
+
+	void fill(BenchDocument &doc, size_t targetSize)
+	{
+		doc.id = 1234567890123LL;
+		doc.name = "encode size benchmark";
+		doc.items.ref().clear();
+		doc.values.ref().clear();
+		while (doc.serializedSize() < targetSize)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				doc.items.ref().push_back("item value of some length");
+				doc.values.ref().push_back(i);
+			}
+		}
+	}
+}
+
+int main()
+{
+	static const size_t sizes[] = { 1024, 64 * 1024, 8 * 1024 * 1024 };
+
+	bench::printHeader("document", "bytes", "byte-append us", "reserved us");
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		BenchDocument doc;
+		size_t encodedSize;
+		int iterations = (int)((256 * 1024 * 1024) / sizes[i]);
+		double before;
+		double after;
+		fill(doc, sizes[i]);
+		encodedSize = doc.serializedSize();
+		if (iterations > 100000)
+			iterations = 100000;
+
+		before = bench::measure(iterations, [&doc]() {
+			std::vector<unsigned char> payload;
+			ByteAppendSink sink(payload);
+			doc.serializeTo(sink);
+		});
+		after = bench::measure(iterations, [&doc]() {
+			std::vector<unsigned char> payload;
+			doc.serialize(payload);
+		});
+		bench::printResult("serialize", encodedSize, before, after);
+	}
+	return 0;
+}
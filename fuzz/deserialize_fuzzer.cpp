@@ -0,0 +1,88 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	deserialize_fuzzer.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ *
+ * libFuzzer entry point feeding arbitrary input to tryDeserialize, once into a fresh object and once into
+ * an object recycled from the previous input.
+ *
+ *   clang++ -g -O1 -std=c++14 -fsanitize=fuzzer,address,undefined -I.. deserialize_fuzzer.cpp ../Serializable.cpp ../BsonSink.cpp ../BsonArena.cpp -o deserialize_fuzzer
+ */
+
+#include "../Serializable.h"
+
+namespace {
+
+	class FuzzInner : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> id;
+		JsBsonRPC::SType<std::string> name;
+
+		FuzzInner() : Serializable("fuzzinner", 1) {
+			serializableMapMember("id", id);
+			serializableMapMember("name", name);
+		}
+	};
+
+	class FuzzObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int64_t> i;
+		JsBsonRPC::SType<double> d;
+		JsBsonRPC::SType<bool> b;
+		JsBsonRPC::SType<std::string> s;
+		JsBsonRPC::SType< std::vector<uint8_t> > bin;
+		JsBsonRPC::SType< std::list<int32_t> > ints;
+		JsBsonRPC::SType< std::map<std::string, std::string> > m;
+		JsBsonRPC::SType<FuzzInner> inner;
+		JsBsonRPC::SType< std::list<FuzzInner> > inners;
+
+		FuzzObject() : Serializable("fuzzobject", 1) {
+			serializableMapMember("i", i);
+			serializableMapMember("d", d);
+			serializableMapMember("b", b);
+			serializableMapMember("s", s);
+			serializableMapMember("bin", bin);
+			serializableMapMember("ints", ints);
+			serializableMapMember("m", m);
+			serializableMapMember("inner", inner);
+			serializableMapMember("inners", inners);
+		}
+	};
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static FuzzObject recycled;
+	static bool configured = false;
+	FuzzObject fresh;
+	if (!configured)
+	{
+		recycled.serializableConfigure(JsBsonRPC::DeserializationConfig::RECYCLE_OBJECTS, true);
+		configured = true;
+	}
+	fresh.tryDeserialize(data, size);
+	recycled.tryDeserialize(data, size);
+	return 0;
+}
@@ -87,17 +87,17 @@ namespace JsBsonRPC {
 		return 1;
 	}
 
-	static uint32_t writeKeyToBson(std::vector<unsigned char> &payload, const std::string &key)
+	static uint32_t writeKeyToBson(std::vector<unsigned char> &payload, const BsonStringView &key)
 	{
-		payload.insert(payload.end(), key.begin(), key.end());
+		payload.insert(payload.end(), key.data(), key.data() + key.length());
 		payload.push_back(0);
 		return key.length() + 1;
 	}
 
-	static uint32_t jsonArrayToBson(std::vector<unsigned char> &payload, const std::string& key, const rapidjson::Value &jsonObject);
-	static uint32_t jsonObjectToBson(std::vector<unsigned char> &payload, const std::string& key, const rapidjson::Value &jsonObject);
+	static uint32_t jsonArrayToBson(std::vector<unsigned char> &payload, const BsonStringView &key, const rapidjson::Value &jsonObject);
+	static uint32_t jsonObjectToBson(std::vector<unsigned char> &payload, const BsonStringView &key, const rapidjson::Value &jsonObject);
 
-	static uint32_t addJsonValueToBson(std::vector<unsigned char> &payload, const std::string &key, const rapidjson::Value& jsonValue)
+	static uint32_t addJsonValueToBson(std::vector<unsigned char> &payload, const BsonStringView &key, const rapidjson::Value& jsonValue)
 	{
 		uint32_t payloadSize = 1;
 		uint8_t bsonType = 0;
@@ -164,21 +164,20 @@ namespace JsBsonRPC {
 		return payloadSize;
 	}
 
-	static uint32_t jsonArrayToBson(std::vector<unsigned char> &payload, const std::string& key, const rapidjson::Value &jsonObject)
+	static uint32_t jsonArrayToBson(std::vector<unsigned char> &payload, const BsonStringView &key, const rapidjson::Value &jsonObject)
 	{
 		uint32_t payloadSize = 1;
 		uint32_t subDocSize = 5;
 		uint32_t headOffset = 0;
-		int i = 0;
+		uint32_t i = 0;
 		payload.push_back(internal::BSONTYPE_ARRAY);
 		payloadSize += writeKeyToBson(payload, key);
 		headOffset = payload.size();
 		payload.push_back(0); payload.push_back(0); payload.push_back(0); payload.push_back(0);
 		for (rapidjson::Value::ConstValueIterator iter = jsonObject.Begin(); iter != jsonObject.End(); iter++)
 		{
-			char key[32] = {0};
-			internal::_my_itoa(i, key, sizeof(key), 10);
-			subDocSize += addJsonValueToBson(payload, key, *iter);
+			internal::IndexKeyBuffer keyBuffer;
+			subDocSize += addJsonValueToBson(payload, internal::indexKey(i, keyBuffer), *iter);
 			i++;
 		}
 		payload.push_back(0);
@@ -188,7 +187,7 @@ namespace JsBsonRPC {
 		payload[headOffset + 3] = (unsigned char)(subDocSize >> 24);
 		return payloadSize + subDocSize;
 	}
-	static uint32_t jsonObjectToBson(std::vector<unsigned char> &payload, const std::string& key, const rapidjson::Value &jsonObject)
+	static uint32_t jsonObjectToBson(std::vector<unsigned char> &payload, const BsonStringView &key, const rapidjson::Value &jsonObject)
 	{
 		uint32_t payloadSize = 0;
 		uint32_t subDocSize = 5;
@@ -201,7 +200,7 @@ namespace JsBsonRPC {
 		payload.push_back(0); payload.push_back(0); payload.push_back(0); payload.push_back(0);
 		for (rapidjson::Value::ConstMemberIterator iter = jsonObject.MemberBegin(); iter != jsonObject.MemberEnd(); iter++)
 		{
-			subDocSize += addJsonValueToBson(payload, std::string(iter->name.GetString(), iter->name.GetStringLength()), iter->value);
+			subDocSize += addJsonValueToBson(payload, BsonStringView(iter->name.GetString(), iter->name.GetStringLength()), iter->value);
 		}
 		payload.push_back(0);
 		payload[headOffset + 0] = (unsigned char)(subDocSize >> 0);
@@ -213,11 +212,11 @@ namespace JsBsonRPC {
 
 	void JSONObjectMapper::serializeTo(const Serializable *serialiable, rapidjson::Document &jsonDoc) throw(TypeNotSupportException, ConvertException)
 	{
-		ConvertContext convertContext(jsonDoc, internal::BSONTYPE_DOCUMENT);
+		ConvertContext convertContext(jsonDoc, internal::BSONTYPE_DOCUMENT, m_skipUnsupportedTypes);
 		std::vector<unsigned char> bsonPayload;
 		uint32_t offset = 0;
 		serialiable->serialize(bsonPayload);
-		internal::BsonParser parser(bsonPayload, bsonPayload.size(), &offset, DeserializationConfig::getDefaultConfigure());
+		internal::BsonParser parser(bsonPayload.data(), bsonPayload.size(), &offset, DeserializationConfig::getDefaultConfigure(), true);
 		parser.parse(&convertContext);
 	}
 
@@ -249,11 +248,11 @@ namespace JsBsonRPC {
 		doc.AddMember(jsonKey, jsonValue, doc.GetAllocator());
 	}
 
-	bool JSONObjectMapper::ConvertContext::bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) throw(TypeNotSupportException, ConvertException)
+	bool JSONObjectMapper::ConvertContext::bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) throw(TypeNotSupportException, ConvertException)
 	{
 		rapidjson::Value jsonKey;
 		rapidjson::Value jsonValue;
-		jsonKey.SetString(name.c_str(), name.length(), doc.GetAllocator());
+		jsonKey.SetString(name.data(), name.length(), doc.GetAllocator());
 
 		switch(type)
 		{
@@ -263,7 +262,7 @@ namespace JsBsonRPC {
 		case internal::BSONTYPE_STRING_UTF8:
 		{
 			uint32_t len = internal::readValue<uint32_t>(payload, offset, docEndPos);
-			if ((docEndPos - *offset) < len)
+			if ((len == 0) || ((docEndPos - *offset) < len))
 				throw ConvertException();
 			if (payload[*offset + len - 1] == 0)
 				jsonValue.SetString((const char*)&payload[*offset], len - 1, doc.GetAllocator());
@@ -275,8 +274,8 @@ namespace JsBsonRPC {
 		case internal::BSONTYPE_DOCUMENT:
 		{
 			rapidjson::Document subDoc;
-			ConvertContext convertContext(subDoc, internal::BSONTYPE_DOCUMENT);
-			internal::BsonParser parser(payload, payload.size(), offset, DeserializationConfig::getDefaultConfigure());
+			ConvertContext convertContext(subDoc, internal::BSONTYPE_DOCUMENT, skipUnsupportedTypes);
+			internal::BsonParser parser(payload, docEndPos, offset, DeserializationConfig::getDefaultConfigure());
 			parser.parse(&convertContext);
 			jsonValue.CopyFrom(convertContext.doc, doc.GetAllocator());
 		}
@@ -284,8 +283,8 @@ namespace JsBsonRPC {
 		case internal::BSONTYPE_ARRAY:
 		{
 			rapidjson::Document subDoc;
-			ConvertContext convertContext(subDoc, internal::BSONTYPE_ARRAY);
-			internal::BsonParser parser(payload, payload.size(), offset, DeserializationConfig::getDefaultConfigure());
+			ConvertContext convertContext(subDoc, internal::BSONTYPE_ARRAY, skipUnsupportedTypes);
+			internal::BsonParser parser(payload, docEndPos, offset, DeserializationConfig::getDefaultConfigure());
 			parser.parse(&convertContext);
 			jsonValue.CopyFrom(convertContext.doc, doc.GetAllocator());
 		}
@@ -295,6 +294,8 @@ namespace JsBsonRPC {
 		{
 			uint32_t len = internal::readValue<uint32_t>(payload, offset, docEndPos);
 			uint8_t value = internal::readValue<uint8_t>(payload, offset, docEndPos);
+			if ((docEndPos - *offset) < len)
+				throw ConvertException();
 			std::string encoded = JsCPPUtils::Base64::encodeToText((const char*)&payload[*offset], len);
 			*offset += len;
 			jsonValue.SetString(encoded.c_str(), encoded.length(), doc.GetAllocator());
@@ -320,7 +321,24 @@ namespace JsBsonRPC {
 			jsonValue.SetInt64(internal::readValue<int64_t>(payload, offset, docEndPos));
 			break;
 		default:
-			throw TypeNotSupportException();
+		{
+			uint32_t size = 0;
+			uint32_t avail = docEndPos - *offset;
+			if (!skipUnsupportedTypes)
+				throw TypeNotSupportException();
+			switch (internal::skipValueSize(type, payload + *offset, avail, &size))
+			{
+			case internal::SKIP_OK:
+				if (size > avail)
+					throw ConvertException();
+				*offset += size;
+				return true;
+			case internal::SKIP_UNKNOWN_TYPE:
+				throw TypeNotSupportException();
+			default:
+				throw ConvertException();
+			}
+		}
 		}
 
 		if (bsonType == internal::BSONTYPE_ARRAY)
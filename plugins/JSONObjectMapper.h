@@ -49,18 +49,30 @@ namespace JsBsonRPC {
 		struct ConvertContext : public internal::BsonParseHandler {
 			internal::BsonTypes bsonType;
 			rapidjson::Document &doc;
-			ConvertContext(rapidjson::Document &_document, internal::BsonTypes _bsonType) : doc(_document), bsonType(_bsonType) {
+			bool skipUnsupportedTypes;
+			ConvertContext(rapidjson::Document &_document, internal::BsonTypes _bsonType, bool _skipUnsupportedTypes) : bsonType(_bsonType), doc(_document), skipUnsupportedTypes(_skipUnsupportedTypes) {
 				if (_bsonType == internal::BSONTYPE_DOCUMENT)
 					doc.SetObject();
 				else if (_bsonType == internal::BSONTYPE_ARRAY)
 					doc.SetArray();
 			}
-			bool bsonParseHandle(uint8_t type, const std::string &name, const std::vector<unsigned char>& payload, uint32_t *offset, uint32_t docEndPos) throw(TypeNotSupportException, ConvertException) override;
+			bool bsonParseHandle(uint8_t type, const BsonStringView &name, const unsigned char *payload, uint32_t *offset, uint32_t docEndPos) throw(TypeNotSupportException, ConvertException) override;
 			void serializableNameHandle(const std::string& attrName, const std::string& value) override;
 			void serializableSerialVersionUIDHandle(const std::string& attrName, int64_t value) override;
 		};
 
+		bool m_skipUnsupportedTypes;
+
 	public:
+		JSONObjectMapper() : m_skipUnsupportedTypes(false) {}
+
+		/**
+		 * Drop elements of BSON types JSON has no form for (ObjectId, Decimal128, ...) instead of throwing
+		 * TypeNotSupportException. They are stepped over through the shared skip table. Off by default.
+		 */
+		void setSkipUnsupportedTypes(bool skip) { m_skipUnsupportedTypes = skip; }
+		bool isSkipUnsupportedTypes() const { return m_skipUnsupportedTypes; }
+
 #if defined(HAS_RAPIDJSON) && HAS_RAPIDJSON
 		void serializeTo(const Serializable *serialiable, rapidjson::Document &jsonDoc) throw(TypeNotSupportException, ConvertException);
 		void deserializeJsonObject(Serializable *serialiable, const rapidjson::Value &jsonObject) throw(TypeNotSupportException, ConvertException);
@@ -0,0 +1,1127 @@
+/*
+* Licensed to the Apache Software Foundation (ASF) under one or more
+* contributor license agreements.  See the NOTICE file distributed with
+* this work for additional information regarding copyright ownership.
+* The ASF licenses this file to You under the Apache License, Version 2.0
+* (the "License"); you may not use this file except in compliance with
+* the License.  You may obtain a copy of the License at
+*
+*    http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+/**
+ * @file	serializable_test.cpp
+ * @author	Jichan (development@jc-lab.net / http://ablog.jc-lab.net/ )
+ * @date	2019/04/10
+ * @copyright Copyright (C) 2018 jichan.\n
+ *            This software may be modified and distributed under the terms
+ *            of the Apache License 2.0.  See the LICENSE file for details.
+ *
+ * Standalone regression tests, exits with a non-zero status if any check fails.
+ *
+ *   c++ -std=c++14 -I.. serializable_test.cpp ../Serializable.cpp ../BsonSink.cpp ../BsonArena.cpp ../BsonStreamParser.cpp ../BsonFrame.cpp -o serializable_test
+ */
+
+#include "../Serializable.h"
+#include "../BsonStreamParser.h"
+#include "../BsonFrame.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+	int failures = 0;
+
+#define TEST_CHECK(COND) \
+	do { \
+		if (!(COND)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #COND); \
+			failures++; \
+		} \
+	} while (0)
+
+	/**
+	 * Hand built BSON document, for input serialize() never produces
+	 */
+	class DocBuilder
+	{
+	private:
+		std::vector<unsigned char> m_bytes;
+
+	public:
+		DocBuilder() : m_bytes(4, 0) {}
+
+		DocBuilder &element(uint8_t type, const char *name, const void *value, size_t len) {
+			m_bytes.push_back(type);
+			m_bytes.insert(m_bytes.end(), name, name + strlen(name) + 1);
+			m_bytes.insert(m_bytes.end(), (const unsigned char*)value, (const unsigned char*)value + len);
+			return *this;
+		}
+		DocBuilder &int32(const char *name, int32_t value) {
+			return element(JsBsonRPC::internal::BSONTYPE_INT32, name, &value, sizeof(value));
+		}
+		DocBuilder &string(const char *name, const std::string &value) {
+			std::vector<unsigned char> encoded(4);
+			uint32_t len = (uint32_t)value.length() + 1;
+			memcpy(&encoded[0], &len, sizeof(len));
+			encoded.insert(encoded.end(), value.c_str(), value.c_str() + len);
+			return element(JsBsonRPC::internal::BSONTYPE_STRING_UTF8, name, encoded.data(), encoded.size());
+		}
+		DocBuilder &document(const char *name, const std::vector<unsigned char> &doc, uint8_t type = JsBsonRPC::internal::BSONTYPE_DOCUMENT) {
+			return element(type, name, doc.data(), doc.size());
+		}
+
+		std::vector<unsigned char> finish() {
+			std::vector<unsigned char> doc(m_bytes);
+			uint32_t size;
+			doc.push_back(0);
+			size = (uint32_t)doc.size();
+			memcpy(&doc[0], &size, sizeof(size));
+			return doc;
+		}
+	};
+
+	class CachedObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> a;
+		JsBsonRPC::SType<std::string> b;
+
+		CachedObject() : Serializable("cached", 1) {
+			serializableMapMember("a", a);
+			serializableMapMember("b", b);
+		}
+		CachedObject(CachedObject &&other) : Serializable(std::move(other)), a(other.a), b(other.b) {}
+	};
+
+	void testMoveKeepsFragmentCache()
+	{
+		CachedObject source;
+		std::vector<unsigned char> cached;
+		std::vector<unsigned char> moved;
+		std::vector<unsigned char> expected;
+		source.serializableEnableFragmentCache(true);
+		source.a = 1;
+		source.b = "one";
+		source.serialize(cached);
+
+		CachedObject target(std::move(source));
+		TEST_CHECK(target.serializableIsFragmentCacheEnabled());
+		TEST_CHECK(target.a.isDirty());
+		TEST_CHECK(target.b.isDirty());
+		target.serialize(moved);
+		TEST_CHECK(moved == cached);
+
+		target.a = 2;
+		moved.clear();
+		target.serialize(moved);
+		CachedObject plain;
+		plain.a = 2;
+		plain.b = "one";
+		plain.serialize(expected);
+		TEST_CHECK(moved == expected);
+	}
+
+	/**
+	 * Registers the same members in either order, so instances disagree with the class wide lookup table
+	 */
+	class OrderedObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> a;
+		JsBsonRPC::SType<int32_t> b;
+		JsBsonRPC::SType<int32_t> c;
+
+		OrderedObject(bool reversed = false) : Serializable("orderedobject", 1) {
+			if (reversed) {
+				serializableMapMember("c", c);
+				serializableMapMember("b", b);
+				serializableMapMember("a", a);
+			} else {
+				serializableMapMember("a", a);
+				serializableMapMember("b", b);
+				serializableMapMember("c", c);
+			}
+		}
+	};
+
+	void testMemberOrderDiffersBetweenInstances()
+	{
+		OrderedObject forward;
+		OrderedObject reversed(true);
+		OrderedObject decodedForward;
+		OrderedObject decodedReversed(true);
+		std::vector<unsigned char> forwardPayload;
+		std::vector<unsigned char> reversedPayload;
+		forward.a = 1;
+		forward.b = 2;
+		forward.c = 3;
+		reversed.a = 1;
+		reversed.b = 2;
+		reversed.c = 3;
+		forward.serialize(forwardPayload);
+		reversed.serialize(reversedPayload);
+
+		// Out of order for both, so both go through the lookup table
+		decodedForward.deserialize(reversedPayload);
+		decodedReversed.deserialize(forwardPayload);
+		TEST_CHECK((decodedForward.a.get() == 1) && (decodedForward.b.get() == 2) && (decodedForward.c.get() == 3));
+		TEST_CHECK((decodedReversed.a.get() == 1) && (decodedReversed.b.get() == 2) && (decodedReversed.c.get() == 3));
+	}
+
+	class MapObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType< std::map<std::string, int32_t> > m;
+
+		MapObject() : Serializable("mapobject", 1) {
+			serializableMapMember("m", m);
+		}
+	};
+
+	void checkMapRoundTrip(const char *phase)
+	{
+		MapObject source;
+		MapObject decoded;
+		std::vector<unsigned char> payload;
+		JsBsonRPC::DecodeStatus status;
+		source.m.ref()["@t"] = 7;
+		source.m.ref()["x"] = 8;
+		source.serialize(payload);
+
+		decoded.deserialize(payload);
+		TEST_CHECK(decoded.m.get() == source.m.get());
+
+		decoded.m.ref().clear();
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.ok());
+		TEST_CHECK(decoded.m.get() == source.m.get());
+		if (!status.ok())
+			fprintf(stderr, "%s: %s path=%s\n", phase, JsBsonRPC::DecodeStatus::kindName(status.kind), status.path.c_str());
+	}
+
+	void testMapKeyLikeCompactEnvelope()
+	{
+		checkMapRoundTrip("legacy envelope");
+
+		JsBsonRPC::SerializableTypeIds::registerType(1, "mapobject", 1);
+		checkMapRoundTrip("type id registered");
+
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(true);
+		checkMapRoundTrip("compact envelope");
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(false);
+	}
+
+	void testCompactEnvelopeReadWithoutFlag()
+	{
+		MapObject source;
+		MapObject decoded;
+		std::vector<unsigned char> compact;
+		std::vector<unsigned char> legacy;
+		std::string name;
+		int64_t version = 0;
+		source.m.ref()["x"] = 8;
+		source.serialize(legacy);
+		JsBsonRPC::SerializableTypeIds::registerType(1, "mapobject", 1);
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(true);
+		source.serialize(compact);
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(false);
+		TEST_CHECK(compact.size() < legacy.size());
+
+		// A peer that has the id registered but does not send compact envelopes itself
+		decoded.serializableConfigure(JsBsonRPC::DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES, true);
+		TEST_CHECK(decoded.tryDeserialize(compact).ok());
+		TEST_CHECK(decoded.m.get() == source.m.get());
+		TEST_CHECK(JsBsonRPC::Serializable::readMetadata(compact, 0, &name, &version));
+		TEST_CHECK((name == "mapobject") && (version == 1));
+	}
+
+	class ArenaObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType< JsBsonRPC::arena::list<JsBsonRPC::arena::string> > items;
+		JsBsonRPC::SType< JsBsonRPC::arena::map<int32_t> > m;
+
+		ArenaObject() : Serializable("arenaobject", 1) {
+			serializableMapMember("items", items);
+			serializableMapMember("m", m);
+		}
+	};
+
+	class RecycleObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType< std::map<std::string, int32_t> > m;
+		JsBsonRPC::SType< std::list<std::string> > items;
+		JsBsonRPC::SType<std::string> s;
+
+		RecycleObject() : Serializable("recycleobject", 1) {
+			serializableMapMember("m", m);
+			serializableMapMember("items", items);
+			serializableMapMember("s", s);
+			serializableConfigure(JsBsonRPC::DeserializationConfig::RECYCLE_OBJECTS, true);
+		}
+
+		void fillStale() {
+			m.ref().clear();
+			m.ref()["a"] = 1;
+			m.ref()["b"] = 2;
+			m.ref()["c"] = 3;
+			items.ref().assign(3, "stale");
+			s = "stale";
+		}
+	};
+
+	void testRecycleTrimsStaleEntries()
+	{
+		RecycleObject source;
+		RecycleObject decoded;
+		std::vector<unsigned char> payload;
+		std::map<std::string, int32_t> expected;
+		source.m.ref()["b"] = 20;
+		source.m.ref()["d"] = 40;
+		source.items.ref().push_back("q");
+		source.s = "fresh";
+		source.serialize(payload);
+
+		decoded.fillStale();
+		decoded.deserialize(payload);
+		TEST_CHECK(decoded.m.get() == source.m.get());
+		TEST_CHECK(decoded.items.get() == source.items.get());
+		TEST_CHECK(decoded.s.get() == "fresh");
+
+		// A repeated key must not make the stale entries look reused, and missing members are cleared
+		payload = DocBuilder().document("m", DocBuilder().int32("b", 5).int32("b", 6).int32("c", 7).finish()).finish();
+		decoded.fillStale();
+		decoded.deserialize(payload);
+		expected["b"] = 6;
+		expected["c"] = 7;
+		TEST_CHECK(decoded.m.get() == expected);
+		TEST_CHECK(decoded.items.get().empty());
+		TEST_CHECK(decoded.s.get().empty());
+
+		// Every stale key repeated, so the element count equals the old size
+		payload = DocBuilder().document("m", DocBuilder().int32("a", 1).int32("a", 2).int32("a", 3).finish()).finish();
+		decoded.fillStale();
+		decoded.deserialize(payload);
+		expected.clear();
+		expected["a"] = 3;
+		TEST_CHECK(decoded.m.get() == expected);
+	}
+
+	void testArenaBindsWholeGraph()
+	{
+		ArenaObject source;
+		ArenaObject decoded;
+		JsBsonRPC::BsonArena arena(256);
+		std::vector<unsigned char> payload;
+		source.items.ref().push_back(JsBsonRPC::arena::string(40, 'a'));
+		source.items.ref().push_back(JsBsonRPC::arena::string(40, 'b'));
+		source.m.ref()[JsBsonRPC::arena::string(20, 'k')] = 1;
+		source.serialize(payload);
+
+		// Built on the heap, then decoded into the arena
+		decoded.items.ref().push_back(JsBsonRPC::arena::string(40, 'z'));
+		decoded.deserialize(payload, arena);
+		TEST_CHECK(decoded.items.get().get_allocator().arena() == &arena);
+		TEST_CHECK(decoded.items.get().front().get_allocator().arena() == &arena);
+		TEST_CHECK(decoded.m.get().begin()->first.get_allocator().arena() == &arena);
+		TEST_CHECK(decoded.items.get() == source.items.get());
+		TEST_CHECK(decoded.m.get() == source.m.get());
+
+		// Decoding without the arena moves everything back to the heap, after which the arena can be reset
+		decoded.deserialize(payload);
+		arena.reset();
+		memset(arena.allocate(200, 1), 'Z', 200);
+		TEST_CHECK(decoded.items.get().get_allocator().arena() == NULL);
+		TEST_CHECK(decoded.items.get().back().get_allocator().arena() == NULL);
+		TEST_CHECK(decoded.items.get() == source.items.get());
+		TEST_CHECK(decoded.m.get() == source.m.get());
+	}
+
+	class StreamObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> id;
+		JsBsonRPC::SType<std::string> name;
+		JsBsonRPC::SType< std::map<std::string, int32_t> > m;
+		JsBsonRPC::SType<CachedObject> inner;
+
+		StreamObject() : Serializable("streamobject", 1) {
+			serializableMapMember("id", id);
+			serializableMapMember("name", name);
+			serializableMapMember("m", m);
+			serializableMapMember("inner", inner);
+		}
+
+		bool operator==(const StreamObject &other) const {
+			return (id.get() == other.id.get()) && (name.get() == other.name.get()) && (m.get() == other.m.get())
+				&& (inner.get().a.get() == other.inner.get().a.get()) && (inner.get().b.get() == other.inner.get().b.get());
+		}
+	};
+
+	void testStreamParserSplitAtEveryByte()
+	{
+		StreamObject source;
+		std::vector<unsigned char> payload;
+		size_t docSize;
+		size_t split;
+		source.id = 7;
+		source.name = "stream";
+		source.m.ref()["x"] = 1;
+		source.m.ref()["y"] = 2;
+		source.inner.ref().a = 3;
+		source.inner.ref().b = "inner";
+		source.serialize(payload);
+		docSize = payload.size();
+		// The start of the next document must be left unconsumed
+		payload.push_back(0x42);
+
+		for (split = 0; split <= docSize; split++)
+		{
+			StreamObject decoded;
+			JsBsonRPC::BsonStreamParser parser(&decoded);
+			size_t first = 0;
+			size_t second = 0;
+			TEST_CHECK(parser.feed(payload.data(), split, &first) == JsBsonRPC::BsonStreamParser::STATUS_NEED_MORE || (split == docSize));
+			TEST_CHECK(first == split);
+			TEST_CHECK(parser.feed(payload.data() + split, payload.size() - split, &second) == JsBsonRPC::BsonStreamParser::STATUS_COMPLETE);
+			TEST_CHECK(first + second == docSize);
+			TEST_CHECK(parser.documentSize() == docSize);
+			TEST_CHECK(decoded == source);
+		}
+
+		// One byte at a time, through reset() for a second document
+		{
+			StreamObject decoded;
+			JsBsonRPC::BsonStreamParser parser(&decoded);
+			int round;
+			for (round = 0; round < 2; round++)
+			{
+				size_t pos;
+				decoded.id = 0;
+				decoded.name = "";
+				decoded.m.ref().clear();
+				decoded.inner.ref().b = "";
+				for (pos = 0; pos < docSize; pos++)
+				{
+					size_t consumed = 0;
+					JsBsonRPC::BsonStreamParser::Status status = parser.feed(&payload[pos], 1, &consumed);
+					TEST_CHECK(consumed == 1);
+					TEST_CHECK((status == JsBsonRPC::BsonStreamParser::STATUS_COMPLETE) == (pos + 1 == docSize));
+				}
+				TEST_CHECK(parser.isComplete());
+				TEST_CHECK(decoded == source);
+				parser.reset();
+			}
+		}
+	}
+
+	void testStreamParserRejectsOversizedDocument()
+	{
+		StreamObject source;
+		StreamObject decoded;
+		std::vector<unsigned char> payload;
+		bool thrown = false;
+		source.name = std::string(64, 'x');
+		source.serialize(payload);
+
+		JsBsonRPC::BsonStreamParser parser(&decoded, 32);
+		try {
+			parser.feed(payload.data(), 4);
+		} catch (JsBsonRPC::Serializable::ParseException &e) {
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+
+	/**
+	 * Decodes every frame it is handed, for checking what a BsonFrameReader dispatched
+	 */
+	struct FrameCollector
+	{
+		std::vector<std::string> names;
+		std::vector<int32_t> ids;
+
+		void operator()(const unsigned char *frame, uint32_t size) {
+			StreamObject decoded;
+			decoded.deserialize(frame, size);
+			names.push_back(decoded.name.get());
+			ids.push_back(decoded.id.get());
+		}
+	};
+
+	void testFrameReaderSplitFrames()
+	{
+		std::vector<unsigned char> stream;
+		const int frameCount = 3;
+		size_t split;
+		int i;
+		for (i = 0; i < frameCount; i++)
+		{
+			StreamObject source;
+			source.id = i;
+			source.name = std::string(i * 5 + 1, (char)('a' + i));
+			source.serialize(stream);
+		}
+
+		for (split = 0; split <= stream.size(); split++)
+		{
+			FrameCollector collector;
+			JsBsonRPC::BsonFrameReader reader(std::ref(collector));
+			size_t frames = reader.feed(stream.data(), split);
+			frames += reader.feed(stream.data() + split, stream.size() - split);
+			TEST_CHECK(frames == frameCount);
+			TEST_CHECK(reader.bufferedSize() == 0);
+			TEST_CHECK(collector.ids.size() == frameCount);
+			for (i = 0; (i < frameCount) && (i < (int)collector.ids.size()); i++)
+			{
+				TEST_CHECK(collector.ids[i] == i);
+				TEST_CHECK(collector.names[i] == std::string(i * 5 + 1, (char)('a' + i)));
+			}
+		}
+
+		// Byte by byte, the buffered frame has to survive every call
+		{
+			FrameCollector collector;
+			JsBsonRPC::BsonFrameReader reader(std::ref(collector));
+			size_t frames = 0;
+			for (split = 0; split < stream.size(); split++)
+				frames += reader.feed(&stream[split], 1);
+			TEST_CHECK(frames == frameCount);
+			TEST_CHECK(collector.ids.size() == frameCount);
+		}
+	}
+
+	void testFrameReaderRejectsBadSize()
+	{
+		FrameCollector collector;
+		JsBsonRPC::BsonFrameReader reader(std::ref(collector), 64);
+		StreamObject source;
+		std::vector<unsigned char> payload;
+		const unsigned char tooSmall[4] = { 4, 0, 0, 0 };
+		bool thrown = false;
+		try {
+			reader.feed(tooSmall, 2);
+			reader.feed(tooSmall + 2, 2);
+		} catch (JsBsonRPC::BsonFrameReader::FrameSizeException &e) {
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+
+		reader.reset();
+		source.name = std::string(100, 'x');
+		source.serialize(payload);
+		thrown = false;
+		try {
+			reader.feed(payload.data(), payload.size());
+		} catch (JsBsonRPC::BsonFrameReader::FrameSizeException &e) {
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+		TEST_CHECK(collector.ids.empty());
+	}
+
+	void testFrameWriterPartialWrites()
+	{
+		int fds[2];
+		const int frameCount = 300;
+		FrameCollector collector;
+		JsBsonRPC::BsonFrameReader reader(std::ref(collector));
+		size_t queued;
+		size_t sent = 0;
+		int i;
+		if (pipe(fds) != 0)
+		{
+			TEST_CHECK(!"pipe");
+			return;
+		}
+		// Small chunks so a partial write stops inside a chunk, and more bytes than the pipe holds
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		JsBsonRPC::BsonFrameWriter writer(fds[1], 100);
+		for (i = 0; i < frameCount; i++)
+		{
+			StreamObject source;
+			source.id = i;
+			source.name = std::string(500, (char)('a' + (i % 26)));
+			writer.add(source);
+		}
+		queued = writer.pendingSize();
+
+		while (writer.pendingSize() > 0)
+		{
+			ssize_t written = writer.flush();
+			TEST_CHECK(written >= 0);
+			if (written < 0)
+				break;
+			sent += written;
+			if (writer.pendingSize() > 0)
+				TEST_CHECK(reader.readFrom(fds[0]) > 0);
+		}
+		TEST_CHECK(sent == queued);
+		close(fds[1]);
+		while (reader.readFrom(fds[0]) > 0)
+			;
+		close(fds[0]);
+
+		TEST_CHECK(collector.ids.size() == frameCount);
+		for (i = 0; (i < frameCount) && (i < (int)collector.ids.size()); i++)
+		{
+			TEST_CHECK(collector.ids[i] == i);
+			TEST_CHECK(collector.names[i] == std::string(500, (char)('a' + (i % 26))));
+		}
+	}
+
+	void testTryDeserializeReportsWhereItFailed()
+	{
+		StreamObject decoded;
+		JsBsonRPC::DecodeStatus status;
+		std::vector<unsigned char> inner;
+		std::vector<unsigned char> payload;
+		size_t innerOffset;
+		const unsigned char unterminated[] = { 3, 0, 0, 0, 'a', 'b', 'c' };
+		const unsigned char unknownValue[] = { 1, 2 };
+		decoded.id = 99;
+		decoded.name = "untouched";
+
+		// A string without its NUL, inside a nested document
+		inner = DocBuilder().int32("a", 1).element(JsBsonRPC::internal::BSONTYPE_STRING_UTF8, "b", unterminated, sizeof(unterminated)).finish();
+		payload = DocBuilder().int32("id", 5).document("inner", inner).finish();
+		innerOffset = payload.size() - 1 - inner.size();
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_BAD_STRING);
+		TEST_CHECK(status.offset == innerOffset + inner.size() - 2);
+		TEST_CHECK(status.path == "inner.b");
+		TEST_CHECK((decoded.id.get() == 99) && (decoded.name.get() == "untouched"));
+
+		// A type the skip table does not know, reported at its type byte
+		payload = DocBuilder().int32("id", 5).element(0x30, "odd", unknownValue, sizeof(unknownValue)).finish();
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_UNKNOWN_TYPE);
+		TEST_CHECK(status.offset == 4 + 1 + 3 + 4);
+		TEST_CHECK(status.path == "odd");
+		TEST_CHECK(decoded.id.get() == 99);
+
+		// Cut short, so the root size runs past the input
+		payload = DocBuilder().int32("id", 5).finish();
+		status = decoded.tryDeserialize(payload.data(), payload.size() - 1);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_BAD_SIZE);
+		TEST_CHECK(status.offset == 0);
+		TEST_CHECK(status.path.empty());
+
+		// Well-formed, but the member cannot take a string
+		payload = DocBuilder().string("name", "fresh").string("id", "five").finish();
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_REJECTED);
+		TEST_CHECK(status.offset == 4 + 1 + 5 + 4 + 6);
+		TEST_CHECK(status.path == "id");
+		TEST_CHECK(decoded.name.get() == "fresh");
+		TEST_CHECK(strcmp(JsBsonRPC::DecodeStatus::kindName(status.kind), JsBsonRPC::DecodeStatus::kindName(JsBsonRPC::DecodeStatus::DECODE_OK)) != 0);
+
+		payload.clear();
+		decoded.id = 1;
+		decoded.serialize(payload);
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.ok());
+		TEST_CHECK(status.path.empty());
+	}
+
+	class ProjectedObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> id;
+		JsBsonRPC::SType<std::string> name;
+		JsBsonRPC::SType<CachedObject> inner;
+		JsBsonRPC::SType< std::list<CachedObject> > items;
+
+		ProjectedObject() : Serializable("projectedobject", 1) {
+			serializableMapMember("id", id);
+			serializableMapMember("name", name);
+			serializableMapMember("inner", inner);
+			serializableMapMember("items", items);
+		}
+	};
+
+	void testProjectionDecodesSelectedMembersOnly()
+	{
+		ProjectedObject source;
+		ProjectedObject decoded;
+		std::vector<unsigned char> payload;
+		int i;
+		source.id = 1;
+		source.name = "source";
+		source.inner.ref().a = 2;
+		source.inner.ref().b = "inner";
+		for (i = 0; i < 3; i++)
+		{
+			source.items.ref().emplace_back();
+			source.items.ref().back().a = 10 + i;
+			source.items.ref().back().b = "item";
+		}
+		source.serialize(payload);
+
+		decoded.name = "kept";
+		decoded.inner.ref().a = 99;
+		decoded.deserialize(payload, JsBsonRPC::BsonProjection({ "id", "inner.b", "items.a" }));
+		TEST_CHECK(decoded.id.get() == 1);
+		TEST_CHECK(decoded.name.get() == "kept");
+		TEST_CHECK(decoded.inner.get().a.get() == 99);
+		TEST_CHECK(decoded.inner.get().b.get() == "inner");
+		TEST_CHECK(decoded.items.get().size() == 3);
+		i = 0;
+		for (std::list<CachedObject>::const_iterator iter = decoded.items.get().begin(); iter != decoded.items.get().end(); iter++, i++)
+		{
+			TEST_CHECK(iter->a.get() == 10 + i);
+			TEST_CHECK(iter->b.get().empty());
+		}
+
+		// A whole member selects everything below it, and the projection does not outlive the call
+		decoded.deserialize(payload, JsBsonRPC::BsonProjection({ "inner" }));
+		TEST_CHECK(decoded.inner.get().a.get() == 2);
+		TEST_CHECK(decoded.name.get() == "kept");
+		decoded.deserialize(payload);
+		TEST_CHECK(decoded.name.get() == "source");
+		TEST_CHECK(decoded.items.get().front().b.get() == "item");
+	}
+
+	JsBsonRPC::SerializableRegistry::Registrar<StreamObject> streamObjectRegistrar("streamobject", 1);
+
+	void testRegistryDecodeAny()
+	{
+		StreamObject source;
+		CachedObject unregistered;
+		std::vector<unsigned char> payload;
+		std::vector<unsigned char> compact;
+		std::vector<unsigned char> other;
+		std::vector<unsigned char> broken;
+		JsBsonRPC::Serializable *object;
+		StreamObject *decoded;
+		size_t docSize = 0;
+		bool thrown = false;
+		source.id = 12;
+		source.name = "any";
+		source.m.ref()["k"] = 3;
+		source.serialize(payload);
+
+		TEST_CHECK(JsBsonRPC::SerializableRegistry::isRegistered("streamobject", 1));
+		TEST_CHECK(!JsBsonRPC::SerializableRegistry::isRegistered("streamobject", 2));
+		TEST_CHECK(!JsBsonRPC::SerializableRegistry::isRegistered("cached", 1));
+
+		object = JsBsonRPC::Serializable::decodeAny(payload, 0, &docSize);
+		decoded = dynamic_cast<StreamObject*>(object);
+		TEST_CHECK(decoded != NULL);
+		TEST_CHECK(decoded && (*decoded == source));
+		TEST_CHECK(docSize == payload.size());
+		delete object;
+
+		// The class is found through the compact envelope just the same
+		JsBsonRPC::SerializableTypeIds::registerType(2, "streamobject", 1);
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(true);
+		source.serialize(compact);
+		JsBsonRPC::SerializableTypeIds::setCompactEnvelope(false);
+		TEST_CHECK(compact.size() < payload.size());
+		object = JsBsonRPC::Serializable::decodeAny(compact);
+		decoded = dynamic_cast<StreamObject*>(object);
+		TEST_CHECK(decoded && (*decoded == source));
+		delete object;
+
+		unregistered.serialize(other);
+		TEST_CHECK(JsBsonRPC::Serializable::decodeAny(other) == NULL);
+		TEST_CHECK(JsBsonRPC::Serializable::decodeAny(DocBuilder().int32("id", 1).finish()) == NULL);
+
+		// A member that fails to decode does not leak the new instance
+		broken = DocBuilder().string("@jsbsonrpcsname", "streamobject").element(JsBsonRPC::internal::BSONTYPE_INT64, "@jsbsonrpcsver", "\1\0\0\0\0\0\0\0", 8).string("id", "x").finish();
+		try {
+			JsBsonRPC::Serializable::decodeAny(broken);
+		} catch (JsBsonRPC::Serializable::ParseException &e) {
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+
+	class SchemaObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> a;
+		JsBsonRPC::SType<std::string> b;
+		JsBsonRPC::SType< std::list<int32_t> > c;
+		JsBsonRPC::SType<int32_t> extra;
+
+		JSBSONRPC_SCHEMA(SchemaObject, "schemaobject", 1, JSBSONRPC_FIELD(SchemaObject, a), JSBSONRPC_FIELD(SchemaObject, b), JSBSONRPC_FIELD(SchemaObject, c))
+		SchemaObject() : Serializable(serializableSchema()) {
+			serializableMapMember("extra", extra);
+		}
+	};
+
+	/**
+	 * The same document declared member by member
+	 */
+	class MappedSchemaObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> a;
+		JsBsonRPC::SType<std::string> b;
+		JsBsonRPC::SType< std::list<int32_t> > c;
+		JsBsonRPC::SType<int32_t> extra;
+
+		MappedSchemaObject() : Serializable("schemaobject", 1) {
+			serializableMapMember("a", a);
+			serializableMapMember("b", b);
+			serializableMapMember("c", c);
+			serializableMapMember("extra", extra);
+		}
+	};
+
+	void testSchemaMatchesMappedMembers()
+	{
+		SchemaObject schema;
+		MappedSchemaObject mapped;
+		SchemaObject decoded;
+		std::vector<unsigned char> schemaPayload;
+		std::vector<unsigned char> mappedPayload;
+		std::vector<unsigned char> reordered;
+		std::vector<unsigned char> unknown;
+		schema.a = 1;
+		schema.b = "two";
+		schema.c.ref().push_back(3);
+		schema.extra = 4;
+		mapped.a = 1;
+		mapped.b = "two";
+		mapped.c.ref().push_back(3);
+		mapped.extra = 4;
+
+		schema.serialize(schemaPayload);
+		mapped.serialize(mappedPayload);
+		TEST_CHECK(schemaPayload == mappedPayload);
+		TEST_CHECK(schema.serializedSize() == schemaPayload.size());
+		TEST_CHECK(&schema.serializableSchema() == &decoded.serializableSchema());
+
+		decoded.deserialize(mappedPayload);
+		TEST_CHECK((decoded.a.get() == 1) && (decoded.b.get() == "two") && (decoded.c.get() == schema.c.get()) && (decoded.extra.get() == 4));
+
+		// Out of order members go through the schema lookup table
+		reordered = DocBuilder().int32("extra", 40).string("b", "bee").int32("a", 10).finish();
+		decoded.deserialize(reordered);
+		TEST_CHECK((decoded.a.get() == 10) && (decoded.b.get() == "bee") && (decoded.extra.get() == 40));
+
+		// Fragment cached output is the same bytes
+		schema.serializableEnableFragmentCache(true);
+		schemaPayload.clear();
+		schema.serialize(schemaPayload);
+		schema.b = "two";
+		schemaPayload.clear();
+		schema.serialize(schemaPayload);
+		TEST_CHECK(schemaPayload == mappedPayload);
+
+		unknown = DocBuilder().int32("a", 1).int32("z", 2).finish();
+		decoded.serializableConfigure(JsBsonRPC::DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES, true);
+		TEST_CHECK(decoded.tryDeserialize(unknown).kind == JsBsonRPC::DecodeStatus::DECODE_REJECTED);
+	}
+
+	class LazyObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<int32_t> id;
+		JsBsonRPC::SType< JsBsonRPC::Lazy<CachedObject> > body;
+
+		LazyObject() : Serializable("lazyobject", 1) {
+			serializableMapMember("id", id);
+			serializableMapMember("body", body);
+		}
+	};
+
+	/**
+	 * True when the document ends with the embedded document doc as its last element
+	 */
+	bool endsWithDocument(const std::vector<unsigned char> &payload, const std::vector<unsigned char> &doc)
+	{
+		return (payload.size() > doc.size()) && std::equal(doc.begin(), doc.end(), payload.end() - 1 - doc.size());
+	}
+
+	void testLazyPassthroughAndReencode()
+	{
+		LazyObject decoded;
+		LazyObject expected;
+		std::vector<unsigned char> body;
+		std::vector<unsigned char> payload;
+		std::vector<unsigned char> passthrough;
+		std::vector<unsigned char> reencoded;
+		std::vector<unsigned char> expectedPayload;
+
+		// The body carries a member CachedObject does not know, which only a byte copy keeps
+		body = DocBuilder().int32("a", 5).string("b", "five").int32("unknown", 6).finish();
+		payload = DocBuilder().int32("id", 1).document("body", body).finish();
+		decoded.deserialize(payload);
+		TEST_CHECK(!decoded.body.get().isDecoded());
+		TEST_CHECK(decoded.body.get().rawSize() == body.size());
+		TEST_CHECK(decoded.body.get().rawData() == payload.data() + payload.size() - 1 - body.size());
+
+		decoded.serialize(passthrough);
+		TEST_CHECK(endsWithDocument(passthrough, body));
+		TEST_CHECK(!decoded.body.get().isDecoded());
+
+		// get() decodes, and reading alone keeps the bytes
+		TEST_CHECK(decoded.body.get().get().a.get() == 5);
+		TEST_CHECK(decoded.body.get().get().b.get() == "five");
+		TEST_CHECK(decoded.body.get().isDecoded());
+		passthrough.clear();
+		decoded.serialize(passthrough);
+		TEST_CHECK(endsWithDocument(passthrough, body));
+
+		// ref() drops them, so the member is encoded from the object
+		decoded.body.ref().ref().a = 7;
+		TEST_CHECK(decoded.body.get().rawData() == NULL);
+		decoded.serialize(reencoded);
+		expected.id = 1;
+		expected.body.ref().ref().a = 7;
+		expected.body.ref().ref().b = "five";
+		expected.serialize(expectedPayload);
+		TEST_CHECK(reencoded == expectedPayload);
+
+		decoded.deserialize(reencoded);
+		TEST_CHECK(decoded.body.get().get().a.get() == 7);
+	}
+
+	class ViewObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<JsBsonRPC::BsonStringView> s;
+		JsBsonRPC::SType<JsBsonRPC::BsonBinaryView> bin;
+
+		ViewObject() : Serializable("viewobject", 1) {
+			serializableMapMember("s", s);
+			serializableMapMember("bin", bin);
+		}
+	};
+
+	/**
+	 * The same document with owning members
+	 */
+	class OwnedViewObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType<std::string> s;
+		JsBsonRPC::SType< std::vector<uint8_t> > bin;
+
+		OwnedViewObject() : Serializable("viewobject", 1) {
+			serializableMapMember("s", s);
+			serializableMapMember("bin", bin);
+		}
+	};
+
+	void testStringAndBinaryViews()
+	{
+		OwnedViewObject owned;
+		ViewObject view;
+		ViewObject decoded;
+		std::vector<unsigned char> payload;
+		std::vector<unsigned char> viewPayload;
+		const unsigned char bytes[] = { 0, 1, 2, 0xFF };
+		owned.s = std::string("view\0ed", 7);
+		owned.bin.ref().assign(bytes, bytes + sizeof(bytes));
+		owned.serialize(payload);
+
+		// Decoded in place, pointing into the payload
+		view.deserialize(payload);
+		TEST_CHECK(view.s.get().str() == owned.s.get());
+		TEST_CHECK(view.bin.get().copy() == owned.bin.get());
+		TEST_CHECK(view.bin.get().subtype() == 0);
+		TEST_CHECK(((const unsigned char*)view.s.get().data() > payload.data()) && ((const unsigned char*)view.s.get().data() < payload.data() + payload.size()));
+		TEST_CHECK((view.bin.get().data() > payload.data()) && (view.bin.get().data() < payload.data() + payload.size()));
+
+		// And written back as the same bytes
+		view.serialize(viewPayload);
+		TEST_CHECK(viewPayload == payload);
+		TEST_CHECK(view.serializedSize() == payload.size());
+
+		// The binary subtype survives a round trip, and a view can be built from caller memory
+		view.s = JsBsonRPC::BsonStringView("");
+		view.bin = JsBsonRPC::BsonBinaryView(bytes, sizeof(bytes), 0x80);
+		viewPayload.clear();
+		view.serialize(viewPayload);
+		decoded.deserialize(viewPayload);
+		TEST_CHECK(decoded.s.get().empty());
+		TEST_CHECK(decoded.bin.get().subtype() == 0x80);
+		TEST_CHECK(decoded.bin.get().copy() == owned.bin.get());
+
+		payload = DocBuilder().string("bin", "not binary").finish();
+		TEST_CHECK(decoded.tryDeserialize(payload).kind == JsBsonRPC::DecodeStatus::DECODE_REJECTED);
+	}
+
+	class ContainerObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType< std::vector<int32_t> > packed;
+		JsBsonRPC::SType< std::vector<std::string> > strings;
+		JsBsonRPC::SType< std::deque<int32_t> > queue;
+		JsBsonRPC::SType< std::unordered_map<std::string, int32_t> > hashed;
+		JsBsonRPC::SType< JsBsonRPC::SortedKeysUnorderedMap<std::string> > sorted;
+
+		ContainerObject() : Serializable("containerobject", 1) {
+			serializableMapMember("packed", packed);
+			serializableMapMember("strings", strings);
+			serializableMapMember("queue", queue);
+			serializableMapMember("hashed", hashed);
+			serializableMapMember("sorted", sorted);
+		}
+	};
+
+	/**
+	 * The arrays and the sorted map of ContainerObject with the containers that always had them
+	 */
+	class ListContainerObject : public JsBsonRPC::Serializable
+	{
+	public:
+		JsBsonRPC::SType< std::vector<int32_t> > packed;
+		JsBsonRPC::SType< std::list<std::string> > strings;
+		JsBsonRPC::SType< std::list<int32_t> > queue;
+		JsBsonRPC::SType< std::map<std::string, int32_t> > hashed;
+		JsBsonRPC::SType< std::map<std::string, std::string> > sorted;
+
+		ListContainerObject() : Serializable("containerobject", 1) {
+			serializableMapMember("packed", packed);
+			serializableMapMember("strings", strings);
+			serializableMapMember("queue", queue);
+			serializableMapMember("hashed", hashed);
+			serializableMapMember("sorted", sorted);
+		}
+	};
+
+	void testContainerRoundTrips()
+	{
+		ContainerObject source;
+		ContainerObject decoded;
+		ContainerObject reordered;
+		ListContainerObject lists;
+		std::vector<unsigned char> payload;
+		std::vector<unsigned char> reorderedPayload;
+		std::vector<unsigned char> listPayload;
+		int i;
+		for (i = 0; i < 12; i++)
+		{
+			char key[8];
+			snprintf(key, sizeof(key), "k%d", i);
+			source.packed.ref().push_back(i * 3);
+			source.strings.ref().push_back(std::string(i, 's'));
+			source.queue.ref().push_back(-i);
+			source.sorted.ref()[key] = std::string(key) + "v";
+			lists.packed.ref().push_back(i * 3);
+			lists.strings.ref().push_back(std::string(i, 's'));
+			lists.queue.ref().push_back(-i);
+			lists.sorted.ref()[key] = std::string(key) + "v";
+		}
+		// Keys inserted in the opposite order, so only sorting makes the output match
+		for (i = 11; i >= 0; i--)
+		{
+			char key[8];
+			snprintf(key, sizeof(key), "k%d", i);
+			reordered.sorted.ref()[key] = std::string(key) + "v";
+		}
+		reordered.packed = source.packed.get();
+		reordered.strings = source.strings.get();
+		reordered.queue = source.queue.get();
+		source.hashed.ref()["only"] = 1;
+		reordered.hashed.ref()["only"] = 1;
+		lists.hashed.ref()["only"] = 1;
+
+		source.serialize(payload);
+		decoded.packed.ref().assign(100, 7);
+		decoded.strings.ref().assign(100, "stale");
+		decoded.hashed.ref()["stale"] = 1;
+		decoded.deserialize(payload);
+		TEST_CHECK(decoded.packed.get() == source.packed.get());
+		TEST_CHECK(decoded.strings.get() == source.strings.get());
+		TEST_CHECK(decoded.queue.get() == source.queue.get());
+		TEST_CHECK(decoded.hashed.get() == source.hashed.get());
+		TEST_CHECK(decoded.sorted.get() == source.sorted.get());
+
+		// Arrays and the sorted map are encoded exactly like list and map
+		lists.serialize(listPayload);
+		TEST_CHECK(payload == listPayload);
+		TEST_CHECK(source.serializedSize() == payload.size());
+		reordered.serialize(reorderedPayload);
+		TEST_CHECK(reorderedPayload == payload);
+	}
+
+	void testSkipsUnknownElementsOfEveryType()
+	{
+		const unsigned char objectId[12] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+		const unsigned char decimal128[16] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x40, 0x30 };
+		const char regex[] = "^a.*\0i";
+		const unsigned char maxKey[1] = { 0 };
+		std::vector<unsigned char> inner;
+		std::vector<unsigned char> payload;
+		StreamObject decoded;
+		StreamObject strict;
+		JsBsonRPC::DecodeStatus status;
+
+		inner = DocBuilder().element(0x07, "oid", objectId, sizeof(objectId)).int32("a", 3).element(0x13, "dec", decimal128, sizeof(decimal128)).finish();
+		payload = DocBuilder()
+			.element(0x07, "oid", objectId, sizeof(objectId))
+			.int32("id", 5)
+			.element(0x13, "dec", decimal128, sizeof(decimal128))
+			.element(0x0B, "re", regex, sizeof(regex))
+			.element(0x7F, "max", maxKey, 0)
+			.document("inner", inner)
+			.string("name", "after")
+			.finish();
+
+		decoded.deserialize(payload);
+		TEST_CHECK(decoded.id.get() == 5);
+		TEST_CHECK(decoded.inner.get().a.get() == 3);
+		TEST_CHECK(decoded.name.get() == "after");
+		TEST_CHECK(decoded.tryDeserialize(payload).ok());
+
+		// The same members are unknown to a strict reader, whatever their type
+		strict.serializableConfigure(JsBsonRPC::DeserializationConfig::FAIL_ON_UNKNOWN_PROPERTIES, true);
+		status = strict.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_REJECTED);
+		TEST_CHECK(status.path == "oid");
+		payload = DocBuilder().int32("id", 5).element(0x13, "dec", decimal128, sizeof(decimal128)).finish();
+		status = strict.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_REJECTED);
+		TEST_CHECK(status.path == "dec");
+		TEST_CHECK(strict.tryDeserialize(DocBuilder().int32("id", 5).finish()).ok());
+
+		// A value cut short is caught by the skip table
+		payload = DocBuilder().int32("id", 5).element(0x13, "dec", decimal128, 8).finish();
+		status = decoded.tryDeserialize(payload);
+		TEST_CHECK(status.kind == JsBsonRPC::DecodeStatus::DECODE_TRUNCATED);
+		TEST_CHECK(status.path == "dec");
+	}
+}
+
+int main()
+{
+	testMoveKeepsFragmentCache();
+	testMemberOrderDiffersBetweenInstances();
+	testMapKeyLikeCompactEnvelope();
+	testCompactEnvelopeReadWithoutFlag();
+	testArenaBindsWholeGraph();
+	testRecycleTrimsStaleEntries();
+	testStreamParserSplitAtEveryByte();
+	testStreamParserRejectsOversizedDocument();
+	testFrameReaderSplitFrames();
+	testFrameReaderRejectsBadSize();
+	testFrameWriterPartialWrites();
+	testTryDeserializeReportsWhereItFailed();
+	testProjectionDecodesSelectedMembersOnly();
+	testRegistryDecodeAny();
+	testSchemaMatchesMappedMembers();
+	testLazyPassthroughAndReencode();
+	testStringAndBinaryViews();
+	testContainerRoundTrips();
+	testSkipsUnknownElementsOfEveryType();
+	if (failures)
+		fprintf(stderr, "%d check(s) failed\n", failures);
+	else
+		printf("all tests passed\n");
+	return failures ? 1 : 0;
+}